@@ -7,15 +7,80 @@ struct ts_filter {
   double pid_min;
   double pid_max;
   double only_uid;
-  const double *pid_whitelist;
-  size_t whitelist_count;
+  const struct ts_compiled_filter *compiled; /* may be NULL */
 };
 
+/* Compiled filter predicates (filter.c). Each returns 1 when the process may
+ * pass; a NULL filter passes everything. */
+int ts_filter_match_pid(const struct ts_compiled_filter *f, pid_t pid);
+int ts_filter_lists_pids(const struct ts_compiled_filter *f);
+int ts_filter_match_stat(const struct ts_compiled_filter *f, const char *comm,
+                         long long ppid);
+int ts_filter_match_uid(const struct ts_compiled_filter *f, long long uid);
+int ts_filter_needs_uid(const struct ts_compiled_filter *f);
+int ts_filter_needs_cgroup(const struct ts_compiled_filter *f);
+int ts_filter_match_cgroup(const struct ts_compiled_filter *f,
+                           const char *path);
+int ts_filter_needs_cmdline(const struct ts_compiled_filter *f);
+int ts_filter_match_cmdline(const struct ts_compiled_filter *f,
+                            const char *cmdline);
+
+/* Output placement: element (row, metric) lands at
+ * out[row * row_stride + metric * col_stride]. Row-major is {max_cols, 1};
+ * metric-major is {1, column_stride}. When put_row is set, drivers hand
+ * each row (and its pid or tid) to it instead, and 'out' may be NULL. */
+struct ts_layout {
+  size_t row_stride;
+  size_t col_stride;
+  void (*put_row)(const struct ts_layout *layout, size_t row, double id,
+                  const double *metrics);
+  void *ctx;
+};
+
+/* Store one row of TS_METRIC_COUNT metrics as the layout says (ffi_layer.c) */
+void ts_layout_put(const struct ts_layout *layout, double *out, size_t row,
+                   double id, const double *metrics);
+
 /* The core function that OS-specific files must implement.
  * Populate 'out' with absolute counter values. */
-size_t ts_driver_capture_absolute(double *out, size_t max_rows, size_t max_cols,
+size_t ts_driver_capture_absolute(double *out, size_t max_rows,
+                                  const struct ts_layout *layout,
                                   double *pid_out, const struct ts_filter *filter);
 
+/* Per-thread capture: one row per task of each process the filter selects,
+ * sorted by tid. tgid_out/tid_out may be NULL. Returns rows found. */
+size_t ts_driver_capture_threads(double *out, size_t max_rows,
+                                 const struct ts_layout *layout,
+                                 double *tgid_out, double *tid_out,
+                                 const struct ts_filter *filter);
+
+/* Read one process's metrics without filtering. Returns 1 on success. */
+int ts_driver_read_pid(pid_t pid, double *metrics);
+
+/* List live pids, sorted ascending, into a thread-local buffer that stays
+ * valid until the next capture on this thread. Returns the count. */
+size_t ts_driver_list_pids(const pid_t **pids_out);
+
+/* Process lifecycle listener (proc_events_linux.c; stubs elsewhere). The
+ * queue is process-wide and locked, not thread-local. */
+int ts_driver_events_start(size_t capacity);
+void ts_driver_events_stop(void);
+size_t ts_driver_events_drain(double *out, size_t max_rows,
+                              const struct ts_layout *layout, double *pid_out);
+size_t ts_driver_events_stats(double *out, size_t n);
+
+/* Governor hooks, all scoped to the calling thread. read flags take enum
+ * ts_read_flag; the others return 1 on success. */
+void ts_driver_set_read_flags(unsigned flags);
+/* Stride k the last capture on this thread used under TS_READ_STRIDE (1 when
+ * every id was read). */
+size_t ts_driver_read_stride(void);
+int ts_driver_set_sched_idle(void);
+int ts_driver_set_affinity(size_t cpu);
+
+/* 1 if metric m is a cumulative counter (ffi_layer.c) */
+int ts_is_counter_metric(size_t m);
+
 /* OS-specific resource cleanup */
 void ts_driver_free_thread_resources(void);
 
@@ -5,7 +5,9 @@
 #include <ctype.h>
 #include <dirent.h>
 #include <errno.h>
+#include <fcntl.h>
 #include <limits.h>
+#include <sched.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
@@ -26,6 +28,24 @@ static long ts_page_size = -1;
 static double ts_ticks_to_ns = 0.0;
 static __thread pid_t *ts_pid_buf = NULL;
 static __thread size_t ts_pid_cap = 0;
+static __thread pid_t *ts_tid_buf = NULL;
+static __thread size_t ts_tid_cap = 0;
+
+/* Thread-mode enumeration: (tgid, tid) pairs, sorted by tid */
+struct ts_task_id {
+  pid_t tgid;
+  pid_t tid;
+};
+static __thread struct ts_task_id *ts_task_buf = NULL;
+static __thread size_t ts_task_cap = 0;
+
+/* Governor read flags (enum ts_read_flag) for captures on this thread */
+static __thread unsigned ts_read_flags = 0;
+/* TS_READ_STRIDE k held between process and thread captures, and the k the
+ * last capture used */
+static __thread pid_t ts_stride_procs = 1;
+static __thread pid_t ts_stride_tasks = 1;
+static __thread pid_t ts_stride_last = 1;
 
 
 
@@ -63,77 +83,121 @@ static int ts_cmp_pids(const void *a, const void *b) {
   return (pa < pb) ? -1 : (pa > pb);
 }
 
-static int ts_ensure_pid_capacity(size_t needed) {
-  if (needed <= ts_pid_cap) {
+static int ts_ensure_id_capacity(pid_t **buf, size_t *cap, size_t needed) {
+  if (needed <= *cap) {
     return 1;
   }
-  size_t new_cap = ts_pid_cap ? ts_pid_cap : 1024;
+  size_t new_cap = *cap ? *cap : 1024;
   while (new_cap < needed) {
     new_cap *= 2;
   }
-  pid_t *tmp = realloc(ts_pid_buf, new_cap * sizeof(pid_t));
+  pid_t *tmp = realloc(*buf, new_cap * sizeof(pid_t));
   if (!tmp) {
     return 0;
   }
-  ts_pid_buf = tmp;
-  ts_pid_cap = new_cap;
+  *buf = tmp;
+  *cap = new_cap;
   return 1;
 }
 
-static int ts_read_stat(pid_t pid, unsigned long long *utime,
-                        unsigned long long *stime, unsigned long long *vsize,
-                        long long *rss_pages, int *processor,
-                        unsigned long long *starttime, long *priority,
-                        long *nice, unsigned long *minflt, unsigned long *majflt) {
+/* Fields parsed from <dir>/stat */
+struct ts_proc_stat {
+  unsigned long long utime, stime, vsize, starttime;
+  long long rss_pages, ppid;
+  int processor;
+  long priority, nice;
+  unsigned long minflt, majflt;
+  char comm[64];
+};
+
+/*
+ * Read a small /proc file with a single read(2) into buf and NUL-terminate
+ * it. dir is "/proc/<pid>" or "/proc/<pid>/task/<tid>". Returns the number
+ * of bytes read, or -1 if the file could not be opened (a failed read of an
+ * opened file counts as empty, as with fgets).
+ */
+static ssize_t ts_read_small(const char *dir, const char *name, char *buf,
+                             size_t len) {
   char path[TS_PATH_MAX];
+  int fd = -1;
+  ssize_t n = 0;
+
+  snprintf(path, sizeof(path), "%s/%s", dir, name);
+  fd = open(path, O_RDONLY | O_CLOEXEC);
+  if (fd < 0) return -1;
+  n = read(fd, buf, len - 1);
+  close(fd);
+  if (n < 0) n = 0;
+  buf[n] = '\0';
+  return n;
+}
+
+/* Split buf into lines in place; returns the next line or NULL. */
+static char *ts_next_line(char **cursor) {
+  char *line = *cursor;
+  if (!line || *line == '\0') return NULL;
+  char *nl = strchr(line, '\n');
+  if (nl) {
+    *nl = '\0';
+    *cursor = nl + 1;
+  } else {
+    *cursor = NULL;
+  }
+  return line;
+}
+
+static int ts_read_stat(const char *dir, struct ts_proc_stat *st) {
   char buf[8192]; 
-  FILE *f = NULL;
   char *line = NULL;
   char *rest = NULL;
   char *token = NULL;
   int field = 3;
   int found = 0;
 
-  snprintf(path, sizeof(path), "/proc/%d/stat", pid);
-  f = fopen(path, "r");
-  if (!f) return 0;
+  st->processor = -1;
+  st->ppid = -1;
+  st->comm[0] = '\0';
 
-  if (!fgets(buf, sizeof(buf), f)) {
-    fclose(f);
-    return 0;
-  }
-  
-  size_t len = strlen(buf);
-  if (len > 0 && buf[len-1] != '\n' && !feof(f)) {
-      fclose(f);
-      return 0; 
-  }
-  fclose(f);
+  ssize_t len = ts_read_small(dir, "stat", buf, sizeof(buf));
+  if (len <= 0) return 0;
+  /* A full buffer means the line may be truncated */
+  if ((size_t)len == sizeof(buf) - 1 && buf[len - 1] != '\n') return 0;
 
   line = strrchr(buf, ')');
   if (!line) return 0;
+
+  /* comm may itself contain ')' or spaces: take everything up to the last ')' */
+  char *open_paren = strchr(buf, '(');
+  if (open_paren && open_paren < line) {
+    size_t n = (size_t)(line - open_paren - 1);
+    if (n >= sizeof(st->comm)) n = sizeof(st->comm) - 1;
+    memcpy(st->comm, open_paren + 1, n);
+    st->comm[n] = '\0';
+  }
+
   line++; 
   if (*line == ' ') line++;
 
   rest = line;
-  while ((token = strsep(&rest, " ")) != NULL) {
+  while ((token = strsep(&rest, " \n")) != NULL) {
     if (*token == '\0') continue;
     
     switch (field) {
-        case 10: *minflt = strtoul(token, NULL, 10); found++; break;
-        case 12: *majflt = strtoul(token, NULL, 10); found++; break;
-        case 14: *utime = strtoull(token, NULL, 10); found++; break;
-        case 15: *stime = strtoull(token, NULL, 10); found++; break;
-        case 18: *priority = strtol(token, NULL, 10); found++; break;
-        case 19: *nice = strtol(token, NULL, 10); found++; break;
-        case 22: *starttime = strtoull(token, NULL, 10); found++; break;
-        case 23: *vsize = strtoull(token, NULL, 10); found++; break;
-        case 24: *rss_pages = strtoll(token, NULL, 10); found++; break;
+        case 4: st->ppid = strtoll(token, NULL, 10); break;
+        case 10: st->minflt = strtoul(token, NULL, 10); found++; break;
+        case 12: st->majflt = strtoul(token, NULL, 10); found++; break;
+        case 14: st->utime = strtoull(token, NULL, 10); found++; break;
+        case 15: st->stime = strtoull(token, NULL, 10); found++; break;
+        case 18: st->priority = strtol(token, NULL, 10); found++; break;
+        case 19: st->nice = strtol(token, NULL, 10); found++; break;
+        case 22: st->starttime = strtoull(token, NULL, 10); found++; break;
+        case 23: st->vsize = strtoull(token, NULL, 10); found++; break;
+        case 24: st->rss_pages = strtoll(token, NULL, 10); found++; break;
         case 39: {
             char *endptr = NULL;
-            *processor = (int)strtol(token, &endptr, 10);
+            st->processor = (int)strtol(token, &endptr, 10);
             if (endptr != token) found++;
-            else *processor = -1;
+            else st->processor = -1;
             break;
         }
     }
@@ -143,12 +207,12 @@ static int ts_read_stat(pid_t pid, unsigned long long *utime,
   return found >= 8; 
 }
 
-static void ts_read_status(pid_t pid, long long *num_threads,
+static void ts_read_status(const char *dir, long long *num_threads,
                            long long *vol_ctx, long long *nonvol_ctx,
                            long long *uid, long long *ppid) {
-  char path[TS_PATH_MAX];
-  char buf[512];
-  FILE *f = NULL;
+  char buf[8192];
+  char *cursor = buf;
+  char *line = NULL;
 
   *num_threads = -1;
   *vol_ctx = -1;
@@ -156,71 +220,162 @@ static void ts_read_status(pid_t pid, long long *num_threads,
   *uid = -1;
   *ppid = -1;
 
-  snprintf(path, sizeof(path), "/proc/%d/status", pid);
-  f = fopen(path, "r");
-  if (!f) return;
-
-  while (fgets(buf, sizeof(buf), f)) {
-    if (strncmp(buf, "Threads:", 8) == 0) {
-      *num_threads = strtoll(buf + 8, NULL, 10);
-    } else if (strncmp(buf, "voluntary_ctxt_switches:", 24) == 0) {
-      *vol_ctx = strtoll(buf + 24, NULL, 10);
-    } else if (strncmp(buf, "nonvoluntary_ctxt_switches:", 27) == 0) {
-      *nonvol_ctx = strtoll(buf + 27, NULL, 10);
-    } else if (strncmp(buf, "Uid:", 4) == 0) {
-      *uid = strtoll(buf + 4, NULL, 10);
-    } else if (strncmp(buf, "PPid:", 5) == 0) {
-      *ppid = strtoll(buf + 5, NULL, 10);
+  if (ts_read_small(dir, "status", buf, sizeof(buf)) <= 0) return;
+
+  while ((line = ts_next_line(&cursor)) != NULL) {
+    if (strncmp(line, "Threads:", 8) == 0) {
+      *num_threads = strtoll(line + 8, NULL, 10);
+    } else if (strncmp(line, "voluntary_ctxt_switches:", 24) == 0) {
+      *vol_ctx = strtoll(line + 24, NULL, 10);
+    } else if (strncmp(line, "nonvoluntary_ctxt_switches:", 27) == 0) {
+      *nonvol_ctx = strtoll(line + 27, NULL, 10);
+    } else if (strncmp(line, "Uid:", 4) == 0) {
+      *uid = strtoll(line + 4, NULL, 10);
+    } else if (strncmp(line, "PPid:", 5) == 0) {
+      *ppid = strtoll(line + 5, NULL, 10);
     }
   }
-
-  fclose(f);
 }
 
-static void ts_read_io(pid_t pid, long long *read_bytes,
+static void ts_read_io(const char *dir, long long *read_bytes,
                        long long *write_bytes) {
-  char path[TS_PATH_MAX];
   char buf[512];
-  FILE *f = NULL;
+  char *cursor = buf;
+  char *line = NULL;
 
   *read_bytes = -1;
   *write_bytes = -1;
 
-  snprintf(path, sizeof(path), "/proc/%d/io", pid);
-  f = fopen(path, "r");
-  if (!f) return;
+  if (ts_read_small(dir, "io", buf, sizeof(buf)) < 0) return;
 
   *read_bytes = 0;
   *write_bytes = 0;
-  while (fgets(buf, sizeof(buf), f)) {
-    if (strncmp(buf, "read_bytes:", 11) == 0) {
-      *read_bytes = strtoll(buf + 11, NULL, 10);
-    } else if (strncmp(buf, "write_bytes:", 12) == 0) {
-      *write_bytes = strtoll(buf + 12, NULL, 10);
+  while ((line = ts_next_line(&cursor)) != NULL) {
+    if (strncmp(line, "read_bytes:", 11) == 0) {
+      *read_bytes = strtoll(line + 11, NULL, 10);
+    } else if (strncmp(line, "write_bytes:", 12) == 0) {
+      *write_bytes = strtoll(line + 12, NULL, 10);
     }
   }
-
-  fclose(f);
 }
 
-static int ts_pid_in_whitelist(pid_t pid, const double *list, size_t count) {
-  if (!list || count == 0) return 1;
-  for (size_t i = 0; i < count; ++i) {
-    if ((pid_t)list[i] == pid) return 1;
+/* Match each hierarchy's path ("id:controllers:/path") against the filter. */
+static int ts_cgroup_matches(const char *dir,
+                             const struct ts_compiled_filter *f) {
+  char buf[4096];
+  char *cursor = buf;
+  char *line = NULL;
+
+  if (ts_read_small(dir, "cgroup", buf, sizeof(buf)) <= 0) return 0;
+
+  while ((line = ts_next_line(&cursor)) != NULL) {
+    char *cg = strchr(line, ':');
+    if (cg) cg = strchr(cg + 1, ':');
+    if (!cg) continue;
+    if (ts_filter_match_cgroup(f, cg + 1)) return 1;
   }
   return 0;
 }
 
-size_t ts_driver_capture_absolute(double *out, size_t max_rows, size_t max_cols,
-                                  double *pid_out, const struct ts_filter *filter) {
-  DIR *dir = NULL;
-  struct dirent *ent = NULL;
-  size_t found_successes = 0;
-  size_t pids_count = 0;
-  size_t row = 0;
+/* cmdline with NUL separators turned into spaces */
+static int ts_cmdline_matches(const char *dir,
+                              const struct ts_compiled_filter *f) {
+  char buf[4096];
+  ssize_t n = ts_read_small(dir, "cmdline", buf, sizeof(buf));
+  if (n <= 0) return 0;
+  for (ssize_t i = 0; i < n; ++i) {
+    if (buf[i] == '\0') buf[i] = ' ';
+  }
+  while (n > 0 && buf[n - 1] == ' ') n--;
+  buf[n] = '\0';
+  return ts_filter_match_cmdline(f, buf);
+}
+
+/*
+ * Read one process (or task) directory into metrics[], rejecting it as soon
+ * as the file that provides a filtered field has been read. Returns 1 if it
+ * is kept.
+ */
+/* Fields of /proc/<pid>/status; -1 when not read */
+struct ts_proc_status {
+  long long num_threads;
+  long long vol_ctx;
+  long long nonvol_ctx;
+  long long uid;
+  long long ppid;
+};
+
+/*
+ * Staged filter checks, shared by full reads and thread-mode selection:
+ * stat first, cgroup and cmdline only when a predicate needs them, then
+ * status when 'want_status' is set or a uid predicate needs it. Rejected
+ * processes skip the remaining reads. Returns 1 if the process passes.
+ */
+static int ts_filter_stages(const char *dir, const struct ts_filter *filter,
+                            int want_status, struct ts_proc_stat *st,
+                            struct ts_proc_status *status) {
+  const struct ts_compiled_filter *compiled = filter ? filter->compiled : NULL;
+  int uid_filter = (filter && filter->only_uid >= 0) ||
+                   ts_filter_needs_uid(compiled);
+
+  status->num_threads = status->vol_ctx = status->nonvol_ctx = -1;
+  status->uid = status->ppid = -1;
+
+  if (!ts_read_stat(dir, st)) return 0;
+  if (!ts_filter_match_stat(compiled, st->comm, st->ppid)) return 0;
+
+  if (ts_filter_needs_cgroup(compiled) && !ts_cgroup_matches(dir, compiled)) {
+    return 0;
+  }
+  if (ts_filter_needs_cmdline(compiled) && !ts_cmdline_matches(dir, compiled)) {
+    return 0;
+  }
+  if (!want_status && !uid_filter) return 1;
+
+  ts_read_status(dir, &status->num_threads, &status->vol_ctx,
+                 &status->nonvol_ctx, &status->uid, &status->ppid);
+
+  if (filter && filter->only_uid >= 0) {
+    if (status->uid < 0 || status->uid != (long long)filter->only_uid) {
+      return 0;
+    }
+  }
+  return ts_filter_match_uid(compiled, status->uid);
+}
 
-  if (!out || max_cols < TS_METRIC_COUNT) return 0;
+static int ts_read_task(const char *dir, const struct ts_filter *filter,
+                        double *metrics) {
+  struct ts_proc_stat st;
+  struct ts_proc_status status;
+  long long read_bytes = -1, write_bytes = -1;
 
+  if (!ts_filter_stages(dir, filter, 1, &st, &status)) return 0;
+
+  if (!(ts_read_flags & TS_READ_SKIP_IO)) {
+    ts_read_io(dir, &read_bytes, &write_bytes);
+  }
+
+  metrics[TS_UTIME] = (double)st.utime * ts_ticks_to_ns;
+  metrics[TS_STIME] = (double)st.stime * ts_ticks_to_ns;
+  metrics[TS_RSS] = (double)st.rss_pages * (double)ts_page_size;
+  metrics[TS_VSIZE] = (double)st.vsize;
+  metrics[TS_NUM_THREADS] = (double)status.num_threads;
+  metrics[TS_VOL_CTX_SWITCHES] = (double)status.vol_ctx;
+  metrics[TS_NONVOL_CTX_SWITCHES] = (double)status.nonvol_ctx;
+  metrics[TS_PROCESSOR] = (double)st.processor;
+  metrics[TS_IO_READ_BYTES] = (double)read_bytes;
+  metrics[TS_IO_WRITE_BYTES] = (double)write_bytes;
+  metrics[TS_STARTTIME] = (double)st.starttime * ts_ticks_to_ns;
+  metrics[TS_UID] = (double)status.uid;
+  metrics[TS_PPID] = (double)status.ppid;
+  metrics[TS_PRIORITY] = (double)st.priority;
+  metrics[TS_NICE] = (double)st.nice;
+  metrics[TS_MINFLT] = (double)st.minflt;
+  metrics[TS_MAJFLT] = (double)st.majflt;
+  return 1;
+}
+
+static void ts_init_units(void) {
   if (ts_page_size < 0) {
     ts_page_size = sysconf(_SC_PAGESIZE);
     if (ts_page_size <= 0) ts_page_size = 4096;
@@ -231,86 +386,239 @@ size_t ts_driver_capture_absolute(double *out, size_t max_rows, size_t max_cols,
       if (hz <= 0) hz = 100;
       ts_ticks_to_ns = 1e9 / (double)hz;
   }
+}
+
+/* Collect the numeric entries of 'path' into *buf (grown as needed), sorted
+ * ascending. Returns the number of ids, 0 if the directory is unreadable. */
+static size_t ts_list_ids(const char *path, pid_t **buf, size_t *cap) {
+  DIR *dir = NULL;
+  struct dirent *ent = NULL;
+  size_t count = 0;
 
-  dir = opendir("/proc");
+  dir = opendir(path);
   if (!dir) return 0;
 
   while ((ent = readdir(dir)) != NULL) {
-    pid_t pid = 0;
+    pid_t id = 0;
     if (!ts_is_numeric(ent->d_name)) continue;
-    if (!ts_parse_pid(ent->d_name, &pid)) continue;
-    if (!ts_ensure_pid_capacity(pids_count + 1)) break;
-    ts_pid_buf[pids_count++] = pid;
+    if (!ts_parse_pid(ent->d_name, &id)) continue;
+    if (!ts_ensure_id_capacity(buf, cap, count + 1)) break;
+    (*buf)[count++] = id;
   }
   closedir(dir);
 
-  qsort(ts_pid_buf, pids_count, sizeof(pid_t), ts_cmp_pids);
+  qsort(*buf, count, sizeof(pid_t), ts_cmp_pids);
+  return count;
+}
+
+static int ts_filter_pid_pass(const struct ts_filter *filter, pid_t pid) {
+  if (!filter) return 1;
+  if (filter->pid_min >= 0 && pid < (pid_t)filter->pid_min) return 0;
+  if (filter->pid_max >= 0 && pid > (pid_t)filter->pid_max) return 0;
+  return ts_filter_match_pid(filter->compiled, pid);
+}
 
+/* Filters beyond the pid checks need the process files to be read. */
+static int ts_filter_reads_files(const struct ts_filter *filter) {
+  return filter && (filter->only_uid >= 0 || filter->compiled);
+}
 
+/* Process-level filter check (thread-mode selection, stride narrowing): the
+ * staged checks without the status read they do not need, and never io. */
+static int ts_filter_files_pass(const char *dir,
+                                const struct ts_filter *filter) {
+  struct ts_proc_stat st;
+  struct ts_proc_status status;
+  return ts_filter_stages(dir, filter, 0, &st, &status);
+}
+
+/*
+ * TS_READ_STRIDE over n ids that pass the filter: a power of two k with
+ * n / k within max_rows, else 1. Ids are kept when id % k == 0, so the same
+ * subset is read every frame (deltas still match) and subsets nest as k
+ * changes. k grows as soon as the subset no longer fits, but shrinks only
+ * once n fits k / 2 with a quarter to spare, so a count hovering at a
+ * boundary does not flip the subset every frame. Explicitly listed pids are
+ * never strided away.
+ */
+static pid_t ts_read_stride(size_t n, size_t max_rows,
+                            const struct ts_filter *filter, pid_t *held) {
+  pid_t k = *held;
+  if (!(ts_read_flags & TS_READ_STRIDE) || max_rows == 0 ||
+      (filter && ts_filter_lists_pids(filter->compiled))) {
+    k = 1;
+  } else {
+    while ((size_t)k * max_rows < n) k *= 2;
+    while (k > 1 && 4 * n <= 3 * ((size_t)k / 2) * max_rows) k /= 2;
+  }
+  *held = k;
+  ts_stride_last = k;
+  return k;
+}
+
+size_t ts_driver_capture_absolute(double *out, size_t max_rows,
+                                  const struct ts_layout *layout,
+                                  double *pid_out, const struct ts_filter *filter) {
+  size_t found_successes = 0;
+  size_t pids_count = 0;
+  size_t row = 0;
+  pid_t stride = 1;
+  int prefiltered = 0;
+
+  if (!layout || (!out && !layout->put_row)) return 0;
+
+  ts_init_units();
+  pids_count = ts_list_ids("/proc", &ts_pid_buf, &ts_pid_cap);
+
+  /* Striding needs the count that passes the filter: narrow the list first
+   * (file predicates are checked without status or io), then read the
+   * survivors unfiltered */
+  if (ts_read_flags & TS_READ_STRIDE) {
+    size_t kept = 0;
+    for (size_t i = 0; i < pids_count; ++i) {
+      pid_t pid = ts_pid_buf[i];
+      char dir[64];
+      if (!ts_filter_pid_pass(filter, pid)) continue;
+      snprintf(dir, sizeof(dir), "/proc/%d", pid);
+      if (ts_filter_reads_files(filter) && !ts_filter_files_pass(dir, filter)) {
+        continue;
+      }
+      ts_pid_buf[kept++] = pid;
+    }
+    pids_count = kept;
+    stride = ts_read_stride(pids_count, max_rows, filter, &ts_stride_procs);
+    prefiltered = 1;
+  } else {
+    stride = ts_read_stride(pids_count, max_rows, filter, &ts_stride_procs);
+  }
 
   for (size_t i = 0; i < pids_count; ++i) {
-    unsigned long long utime = 0, stime = 0, starttime = 0, vsize = 0;
-    long long rss_pages = 0;
-    int processor = -1;
-    long priority = 0, nice = 0;
-    unsigned long minflt = 0, majflt = 0;
-    long long num_threads = -1, vol_ctx = -1, nonvol_ctx = -1;
-    long long read_bytes = -1, write_bytes = -1;
-    long long uid = -1, ppid = -1;
     pid_t pid = ts_pid_buf[i];
+    char dir[64];
     double metrics[TS_METRIC_COUNT];
-    double *row_ptr = NULL;
 
-    if (filter) {
-      if (filter->pid_min >= 0 && pid < (pid_t)filter->pid_min) continue;
-      if (filter->pid_max >= 0 && pid > (pid_t)filter->pid_max) continue;
-      if (!ts_pid_in_whitelist(pid, filter->pid_whitelist, filter->whitelist_count)) continue;
+    if (pid % stride != 0) continue;
+    if (!prefiltered && !ts_filter_pid_pass(filter, pid)) continue;
+
+    snprintf(dir, sizeof(dir), "/proc/%d", pid);
+    if (!ts_read_task(dir, prefiltered ? NULL : filter, metrics)) continue;
+
+    found_successes++;
+
+    if (row < max_rows) {
+      ts_layout_put(layout, out, row, (double)pid, metrics);
+      if (pid_out) {
+        pid_out[row] = (double)pid;
+      }
+      row++;
     }
+  }
+
+
+  return found_successes;
+}
+
+int ts_driver_read_pid(pid_t pid, double *metrics) {
+  char dir[64];
 
-    if (!ts_read_stat(pid, &utime, &stime, &vsize, &rss_pages, &processor,
-                      &starttime, &priority, &nice, &minflt, &majflt)) continue;
+  if (!metrics || pid <= 0) return 0;
+  ts_init_units();
+  snprintf(dir, sizeof(dir), "/proc/%d", pid);
+  return ts_read_task(dir, NULL, metrics);
+}
+
+size_t ts_driver_list_pids(const pid_t **pids_out) {
+  size_t count = ts_list_ids("/proc", &ts_pid_buf, &ts_pid_cap);
+  *pids_out = ts_pid_buf;
+  return count;
+}
 
-    ts_read_status(pid, &num_threads, &vol_ctx, &nonvol_ctx, &uid, &ppid);
+static int ts_cmp_tasks(const void *a, const void *b) {
+  pid_t ta = ((const struct ts_task_id *)a)->tid;
+  pid_t tb = ((const struct ts_task_id *)b)->tid;
+  return (ta < tb) ? -1 : (ta > tb);
+}
 
-    if (filter && filter->only_uid >= 0) {
-      if (uid < 0 || uid != (long long)filter->only_uid) continue;
+static int ts_ensure_task_capacity(size_t needed) {
+  if (needed <= ts_task_cap) {
+    return 1;
+  }
+  size_t new_cap = ts_task_cap ? ts_task_cap : 4096;
+  while (new_cap < needed) {
+    new_cap *= 2;
+  }
+  struct ts_task_id *tmp = realloc(ts_task_buf, new_cap * sizeof(*tmp));
+  if (!tmp) {
+    return 0;
+  }
+  ts_task_buf = tmp;
+  ts_task_cap = new_cap;
+  return 1;
+}
+
+size_t ts_driver_capture_threads(double *out, size_t max_rows,
+                                 const struct ts_layout *layout,
+                                 double *tgid_out, double *tid_out,
+                                 const struct ts_filter *filter) {
+  size_t pids_count = 0;
+  size_t tasks_count = 0;
+  size_t found_successes = 0;
+  size_t row = 0;
+  pid_t stride = 1;
+
+  if (!layout || (!out && !layout->put_row)) return 0;
+
+  ts_init_units();
+  pids_count = ts_list_ids("/proc", &ts_pid_buf, &ts_pid_cap);
+
+  /* Filters select processes; every thread of a selected process is kept */
+  for (size_t i = 0; i < pids_count; ++i) {
+    pid_t pid = ts_pid_buf[i];
+    char dir[64];
+
+    if (!ts_filter_pid_pass(filter, pid)) continue;
+    snprintf(dir, sizeof(dir), "/proc/%d", pid);
+    if (ts_filter_reads_files(filter) && !ts_filter_files_pass(dir, filter)) {
+      continue;
     }
 
-    ts_read_io(pid, &read_bytes, &write_bytes);
-
-    metrics[TS_UTIME] = (double)utime * ts_ticks_to_ns;
-    metrics[TS_STIME] = (double)stime * ts_ticks_to_ns;
-    metrics[TS_RSS] = (double)rss_pages * (double)ts_page_size;
-    metrics[TS_VSIZE] = (double)vsize;
-    metrics[TS_NUM_THREADS] = (double)num_threads;
-    metrics[TS_VOL_CTX_SWITCHES] = (double)vol_ctx;
-    metrics[TS_NONVOL_CTX_SWITCHES] = (double)nonvol_ctx;
-    metrics[TS_PROCESSOR] = (double)processor;
-    metrics[TS_IO_READ_BYTES] = (double)read_bytes;
-    metrics[TS_IO_WRITE_BYTES] = (double)write_bytes;
-    metrics[TS_STARTTIME] = (double)starttime * ts_ticks_to_ns;
-    metrics[TS_UID] = (double)uid;
-    metrics[TS_PPID] = (double)ppid;
-    metrics[TS_PRIORITY] = (double)priority;
-    metrics[TS_NICE] = (double)nice;
-    metrics[TS_MINFLT] = (double)minflt;
-    metrics[TS_MAJFLT] = (double)majflt;
+    snprintf(dir, sizeof(dir), "/proc/%d/task", pid);
+    size_t tids = ts_list_ids(dir, &ts_tid_buf, &ts_tid_cap);
+    if (!ts_ensure_task_capacity(tasks_count + tids)) break;
+    for (size_t t = 0; t < tids; ++t) {
+      ts_task_buf[tasks_count].tgid = pid;
+      ts_task_buf[tasks_count].tid = ts_tid_buf[t];
+      tasks_count++;
+    }
+  }
+
+  /* TIDs share the PID space, so sorting by tid gives a unique sorted key */
+  qsort(ts_task_buf, tasks_count, sizeof(*ts_task_buf), ts_cmp_tasks);
+  stride = ts_read_stride(tasks_count, max_rows, filter, &ts_stride_tasks);
+
+  for (size_t i = 0; i < tasks_count; ++i) {
+    char dir[96];
+    double metrics[TS_METRIC_COUNT];
+
+    if (ts_task_buf[i].tid % stride != 0) continue;
+    snprintf(dir, sizeof(dir), "/proc/%d/task/%d", ts_task_buf[i].tgid,
+             ts_task_buf[i].tid);
+    if (!ts_read_task(dir, NULL, metrics)) continue;
 
     found_successes++;
 
     if (row < max_rows) {
-      row_ptr = out + (row * max_cols);
-      for (size_t m = 0; m < TS_METRIC_COUNT; ++m) {
-        row_ptr[m] = metrics[m];
+      ts_layout_put(layout, out, row, (double)ts_task_buf[i].tid, metrics);
+      if (tgid_out) {
+        tgid_out[row] = (double)ts_task_buf[i].tgid;
       }
-      if (pid_out) {
-        pid_out[row] = (double)pid;
+      if (tid_out) {
+        tid_out[row] = (double)ts_task_buf[i].tid;
       }
       row++;
     }
   }
 
-
   return found_successes;
 }
 
@@ -320,6 +628,31 @@ void ts_driver_free_thread_resources(void) {
     ts_pid_buf = NULL;
   }
   ts_pid_cap = 0;
+
+  free(ts_tid_buf);
+  ts_tid_buf = NULL;
+  ts_tid_cap = 0;
+  free(ts_task_buf);
+  ts_task_buf = NULL;
+  ts_task_cap = 0;
+}
+
+void ts_driver_set_read_flags(unsigned flags) { ts_read_flags = flags; }
+
+size_t ts_driver_read_stride(void) { return (size_t)ts_stride_last; }
+
+int ts_driver_set_sched_idle(void) {
+  struct sched_param param;
+  memset(&param, 0, sizeof(param));
+  return sched_setscheduler(0, SCHED_IDLE, &param) == 0;
+}
+
+int ts_driver_set_affinity(size_t cpu) {
+  cpu_set_t set;
+  if (cpu >= CPU_SETSIZE) return 0;
+  CPU_ZERO(&set);
+  CPU_SET(cpu, &set);
+  return sched_setaffinity(0, sizeof(set), &set) == 0;
 }
 
 size_t ts_driver_core_count(void) {
@@ -35,22 +35,42 @@ static int cmp_pids(const void *a, const void *b) {
     return (pa < pb) ? -1 : (pa > pb);
 }
 
-static int ts_pid_in_whitelist(pid_t pid, const double *list, size_t count) {
-    if (!list || count == 0) return 1;
-    for (size_t i = 0; i < count; ++i) {
-        if ((pid_t)list[i] == pid) return 1;
+// Map macOS structs to TensorScan metrics
+static void ts_map_metrics(pid_t pid, const struct proc_taskinfo *ti,
+                           const struct proc_bsdinfo *bi, double *r) {
+    r[TS_UTIME] = (double)ti->pti_total_user;
+    r[TS_STIME] = (double)ti->pti_total_system;
+    r[TS_RSS]   = (double)ti->pti_resident_size;
+    r[TS_VSIZE] = (double)ti->pti_virtual_size;
+    r[TS_NUM_THREADS] = (double)ti->pti_threadnum;
+    r[TS_VOL_CTX_SWITCHES] = (double)ti->pti_csw;
+    r[TS_NONVOL_CTX_SWITCHES] = -1; // Not easily available on mach
+    r[TS_PROCESSOR] = (double)ti->pti_policy; // Not exactly core ID, but scheduling policy
+    r[TS_IO_READ_BYTES] = -1;
+    r[TS_IO_WRITE_BYTES] = -1;
+    struct rusage_info_v4 ri;
+    if (proc_pid_rusage(pid, RUSAGE_INFO_V4, (rusage_info_t *)&ri) == 0) {
+        r[TS_IO_READ_BYTES] = (double)ri.ri_diskio_bytesread;
+        r[TS_IO_WRITE_BYTES] = (double)ri.ri_diskio_byteswritten;
     }
-    return 0;
+    r[TS_STARTTIME] = (double)bi->pbi_start_tvsec;
+    r[TS_UID] = (double)bi->pbi_uid;
+    r[TS_PPID] = (double)bi->pbi_ppid;
+    r[TS_PRIORITY] = (double)ti->pti_priority;
+    r[TS_NICE] = (double)bi->pbi_nice;
+    r[TS_MINFLT] = (double)ti->pti_faults;
+    r[TS_MAJFLT] = (double)ti->pti_pageins;
 }
 
 // macOS Implementation of the Snapshot
-size_t ts_driver_capture_absolute(double *out, size_t max_rows, size_t max_cols,
+size_t ts_driver_capture_absolute(double *out, size_t max_rows,
+                                  const struct ts_layout *layout,
                                   double *pid_out, const struct ts_filter *filter) {
     pid_t *pids = NULL;
     int count = get_proc_list(&pids);
     if (count == 0) return 0;
 
-    if (!out || max_cols < TS_METRIC_COUNT) {
+    if (!layout || (!out && !layout->put_row)) {
         free(pids);
         return 0;
     }
@@ -68,7 +88,10 @@ size_t ts_driver_capture_absolute(double *out, size_t max_rows, size_t max_cols,
         if (filter) {
             if (filter->pid_min >= 0 && pid < (pid_t)filter->pid_min) continue;
             if (filter->pid_max >= 0 && pid > (pid_t)filter->pid_max) continue;
-            if (!ts_pid_in_whitelist(pid, filter->pid_whitelist, filter->whitelist_count)) continue;
+            if (!ts_filter_match_pid(filter->compiled, pid)) continue;
+            // No cgroups, and cmdline is not read on macOS
+            if (ts_filter_needs_cgroup(filter->compiled)) continue;
+            if (ts_filter_needs_cmdline(filter->compiled)) continue;
         }
 
         struct proc_taskinfo ti;
@@ -80,34 +103,19 @@ size_t ts_driver_capture_absolute(double *out, size_t max_rows, size_t max_cols,
         ret = proc_pidinfo(pid, PROC_PIDTBSDINFO, 0, &bi, sizeof(bi));
         if (ret <= 0) continue;
 
+        if (filter) {
+            if (!ts_filter_match_stat(filter->compiled, bi.pbi_comm, (long long)bi.pbi_ppid)) continue;
+            if (!ts_filter_match_uid(filter->compiled, (long long)bi.pbi_uid)) continue;
+            if (filter->only_uid >= 0 && bi.pbi_uid != (uid_t)filter->only_uid) continue;
+        }
+
         found_successes++;
         if (row >= max_rows) continue;
 
-        double *r = out + (row * max_cols);
-        
-        // --- Mapping macOS structs to TensorScan Metrics ---
-        r[TS_UTIME] = (double)ti.pti_total_user;
-        r[TS_STIME] = (double)ti.pti_total_system;
-        r[TS_RSS]   = (double)ti.pti_resident_size;
-        r[TS_VSIZE] = (double)ti.pti_virtual_size;
-        r[TS_NUM_THREADS] = (double)ti.pti_threadnum;
-        r[TS_VOL_CTX_SWITCHES] = (double)ti.pti_csw;
-        r[TS_NONVOL_CTX_SWITCHES] = -1; // Not easily available on mach
-        r[TS_PROCESSOR] = (double)ti.pti_policy; // Not exactly core ID, but scheduling policy
-        r[TS_IO_READ_BYTES] = -1;
-        r[TS_IO_WRITE_BYTES] = -1;
-        struct rusage_info_v4 ri;
-        if (proc_pid_rusage(pid, RUSAGE_INFO_V4, (rusage_info_t *)&ri) == 0) {
-            r[TS_IO_READ_BYTES] = (double)ri.ri_diskio_bytesread;
-            r[TS_IO_WRITE_BYTES] = (double)ri.ri_diskio_byteswritten;
-        }
-        r[TS_STARTTIME] = (double)bi.pbi_start_tvsec;
-        r[TS_UID] = (double)bi.pbi_uid;
-        r[TS_PPID] = (double)bi.pbi_ppid;
-        r[TS_PRIORITY] = (double)ti.pti_priority;
-        r[TS_NICE] = (double)bi.pbi_nice;
-        r[TS_MINFLT] = (double)ti.pti_faults;
-        r[TS_MAJFLT] = (double)ti.pti_pageins;
+        double r[TS_METRIC_COUNT];
+        ts_map_metrics(pid, &ti, &bi, r);
+
+        ts_layout_put(layout, out, row, (double)pid, r);
 
         if (pid_out) pid_out[row] = (double)pid;
         row++;
@@ -118,8 +126,80 @@ size_t ts_driver_capture_absolute(double *out, size_t max_rows, size_t max_cols,
     return found_successes;
 }
 
+// Per-thread rows are not implemented on macOS yet
+size_t ts_driver_capture_threads(double *out, size_t max_rows,
+                                 const struct ts_layout *layout,
+                                 double *tgid_out, double *tid_out,
+                                 const struct ts_filter *filter) {
+    (void)out; (void)max_rows; (void)layout;
+    (void)tgid_out; (void)tid_out; (void)filter;
+    return 0;
+}
+
+int ts_driver_read_pid(pid_t pid, double *metrics) {
+    struct proc_taskinfo ti;
+    struct proc_bsdinfo bi;
+
+    if (!metrics || pid <= 0) return 0;
+    if (proc_pidinfo(pid, PROC_PIDTASKINFO, 0, &ti, sizeof(ti)) <= 0) return 0;
+    if (proc_pidinfo(pid, PROC_PIDTBSDINFO, 0, &bi, sizeof(bi)) <= 0) return 0;
+    ts_map_metrics(pid, &ti, &bi, metrics);
+    return 1;
+}
+
+static __thread pid_t *ts_list_buf = NULL;
+static __thread size_t ts_list_cap = 0;
+
+size_t ts_driver_list_pids(const pid_t **pids_out) {
+    pid_t *pids = NULL;
+    int count = get_proc_list(&pids);
+    size_t kept = 0;
+
+    *pids_out = ts_list_buf;
+    if (count <= 0) return 0;
+    if ((size_t)count > ts_list_cap) {
+        pid_t *tmp = realloc(ts_list_buf, (size_t)count * sizeof(pid_t));
+        if (!tmp) {
+            free(pids);
+            return 0;
+        }
+        ts_list_buf = tmp;
+        ts_list_cap = (size_t)count;
+    }
+    qsort(pids, count, sizeof(pid_t), cmp_pids);
+    for (int i = 0; i < count; i++) {
+        if (pids[i] > 0) ts_list_buf[kept++] = pids[i];
+    }
+    free(pids);
+    *pids_out = ts_list_buf;
+    return kept;
+}
+
+// No proc connector on macOS; the event listener is Linux-only
+int ts_driver_events_start(size_t capacity) { (void)capacity; return 0; }
+void ts_driver_events_stop(void) {}
+size_t ts_driver_events_drain(double *out, size_t max_rows,
+                              const struct ts_layout *layout, double *pid_out) {
+    (void)out; (void)max_rows; (void)layout; (void)pid_out;
+    return 0;
+}
+size_t ts_driver_events_stats(double *out, size_t n) {
+    (void)out; (void)n;
+    return 0;
+}
+
+// Read flags, SCHED_IDLE and hard affinity have no libproc equivalent
+void ts_driver_set_read_flags(unsigned flags) { (void)flags; }
+size_t ts_driver_read_stride(void) { return 1; }
+int ts_driver_set_sched_idle(void) { return 0; }
+int ts_driver_set_affinity(size_t cpu) { (void)cpu; return 0; }
+
 // Helpers
-void ts_driver_free_thread_resources(void) { /* No-op for this simple impl */ }
+void ts_driver_free_thread_resources(void) {
+    free(ts_list_buf);
+    ts_list_buf = NULL;
+    ts_list_cap = 0;
+}
 
 size_t ts_driver_core_count(void) {
     int count;
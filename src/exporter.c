@@ -0,0 +1,873 @@
+#define _POSIX_C_SOURCE 200809L
+#include "driver.h"
+
+#include <errno.h>
+#include <fcntl.h>
+#include <netinet/in.h>
+#include <poll.h>
+#include <pthread.h>
+#include <stdarg.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <arpa/inet.h>
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <sys/time.h>
+#include <sys/un.h>
+#include <unistd.h>
+
+#ifndef MSG_NOSIGNAL
+#define MSG_NOSIGNAL 0
+#endif
+
+#define TS_EXP_REQ_MAX 2048
+#define TS_EXP_COMM_LEN 32
+#define TS_EXP_CGROUP_LEN 224
+
+/*
+ * Exposed series, grouped by family (consecutive entries with the same
+ * name). Counters are exposed as absolute totals; the "other" series of a
+ * counter accumulates the deltas of processes outside the top N, so it stays
+ * monotonic while membership changes.
+ */
+struct ts_exp_series {
+  const char *name;
+  const char *type;
+  const char *unit;
+  const char *help;
+  int metric;
+  const char *label; /* extra label pair, or NULL */
+  double scale;
+};
+
+static const struct ts_exp_series ts_exp_series[] = {
+    {"tensorscan_cpu_seconds", "counter", "seconds", "CPU time consumed.",
+     TS_UTIME, "mode=\"user\"", 1e-9},
+    {"tensorscan_cpu_seconds", "counter", "seconds", "CPU time consumed.",
+     TS_STIME, "mode=\"system\"", 1e-9},
+    {"tensorscan_resident_memory_bytes", "gauge", "bytes",
+     "Resident set size.", TS_RSS, NULL, 1},
+    {"tensorscan_virtual_memory_bytes", "gauge", "bytes",
+     "Virtual memory size.", TS_VSIZE, NULL, 1},
+    {"tensorscan_threads", "gauge", NULL, "Number of threads.",
+     TS_NUM_THREADS, NULL, 1},
+    {"tensorscan_context_switches", "counter", NULL, "Context switches.",
+     TS_VOL_CTX_SWITCHES, "kind=\"voluntary\"", 1},
+    {"tensorscan_context_switches", "counter", NULL, "Context switches.",
+     TS_NONVOL_CTX_SWITCHES, "kind=\"involuntary\"", 1},
+    {"tensorscan_io_bytes", "counter", "bytes", "Storage I/O.",
+     TS_IO_READ_BYTES, "direction=\"read\"", 1},
+    {"tensorscan_io_bytes", "counter", "bytes", "Storage I/O.",
+     TS_IO_WRITE_BYTES, "direction=\"write\"", 1},
+    {"tensorscan_page_faults", "counter", NULL, "Page faults.", TS_MINFLT,
+     "kind=\"minor\"", 1},
+    {"tensorscan_page_faults", "counter", NULL, "Page faults.", TS_MAJFLT,
+     "kind=\"major\"", 1},
+};
+#define TS_EXP_SERIES (sizeof(ts_exp_series) / sizeof(ts_exp_series[0]))
+
+/* Previous scrape, one column per field: 0 = pid, 1 = starttime, 2 + s =
+ * absolute value of series s. */
+#define TS_EXP_COLS (2 + TS_EXP_SERIES)
+
+struct ts_exp_cols {
+  double *data;
+  size_t cap;
+  size_t count;
+};
+
+/* A frame of absolute row-major rows (TS_METRIC_COUNT columns) */
+struct ts_exp_frame {
+  double *rows;
+  double *pids;
+  size_t count;
+  size_t cap;
+};
+
+/* Label cache entry, keyed by PID×StartTime */
+struct ts_exp_meta {
+  double pid;
+  double starttime;
+  char comm[TS_EXP_COMM_LEN];
+  char cgroup[TS_EXP_CGROUP_LEN];
+};
+
+struct ts_exp_buf {
+  char *data;
+  size_t len;
+  size_t cap;
+  int failed;
+};
+
+static pthread_mutex_t ts_exp_ctl = PTHREAD_MUTEX_INITIALIZER;
+static pthread_mutex_t ts_exp_lock = PTHREAD_MUTEX_INITIALIZER;
+static pthread_t ts_exp_thread;
+static int ts_exp_running = 0;
+static int ts_exp_listen = -1;
+static int ts_exp_wake[2] = {-1, -1};
+static char ts_exp_unix_path[sizeof(((struct sockaddr_un *)0)->sun_path)];
+
+/* Publisher side (guarded by ts_exp_lock); frames are taken only while
+ * the exporter runs, so nothing is left allocated after a stop */
+static struct ts_exp_frame ts_exp_latest;
+static unsigned long ts_exp_seq = 0;
+static int ts_exp_accepting = 0;
+
+/* Exporter thread only */
+static size_t ts_exp_top_n = 0;
+static int ts_exp_capture = 0;
+static struct ts_exp_frame ts_exp_work;
+static unsigned long ts_exp_seen = 0;
+static struct ts_exp_cols ts_exp_prev;
+static struct ts_exp_cols ts_exp_curr;
+static int ts_exp_have_prev = 0;
+static double ts_exp_other[TS_EXP_SERIES];
+static double *ts_exp_score = NULL;
+static double *ts_exp_total = NULL;
+static long *ts_exp_match = NULL;
+static char *ts_exp_is_top = NULL;
+static size_t ts_exp_scratch_cap = 0;
+static size_t *ts_exp_heap = NULL;
+static struct ts_exp_meta *ts_exp_meta = NULL;
+static size_t ts_exp_meta_mask = 0;
+static struct ts_exp_buf ts_exp_labels; /* label set per top row */
+static size_t *ts_exp_label_off = NULL;
+static struct ts_exp_buf ts_exp_body;
+
+static int ts_exp_cloexec(int fd) {
+  int flags = fcntl(fd, F_GETFD);
+  return flags >= 0 && fcntl(fd, F_SETFD, flags | FD_CLOEXEC) == 0;
+}
+
+static size_t ts_exp_grow(size_t cap, size_t needed) {
+  size_t new_cap = cap ? cap : 1024;
+  while (new_cap < needed) {
+    new_cap *= 2;
+  }
+  return new_cap;
+}
+
+static int ts_exp_frame_reserve(struct ts_exp_frame *f, size_t rows) {
+  if (rows <= f->cap) return 1;
+  size_t new_cap = ts_exp_grow(f->cap, rows);
+  double *r = realloc(f->rows, new_cap * TS_METRIC_COUNT * sizeof(double));
+  if (!r) return 0;
+  f->rows = r;
+  double *p = realloc(f->pids, new_cap * sizeof(double));
+  if (!p) return 0;
+  f->pids = p;
+  f->cap = new_cap;
+  return 1;
+}
+
+static void ts_exp_frame_free(struct ts_exp_frame *f) {
+  free(f->rows);
+  free(f->pids);
+  memset(f, 0, sizeof(*f));
+}
+
+static double *ts_exp_col(const struct ts_exp_cols *c, size_t col) {
+  return c->data + col * c->cap;
+}
+
+/* Grow per-row scratch for n rows; the previous scrape is kept intact. */
+static int ts_exp_reserve_rows(size_t n) {
+  if (n > ts_exp_curr.cap) {
+    size_t new_cap = ts_exp_grow(ts_exp_curr.cap, n);
+    double *tmp = realloc(ts_exp_curr.data,
+                          new_cap * TS_EXP_COLS * sizeof(double));
+    if (!tmp) return 0;
+    ts_exp_curr.data = tmp;
+    ts_exp_curr.cap = new_cap;
+  }
+  if (n > ts_exp_scratch_cap) {
+    size_t new_cap = ts_exp_grow(ts_exp_scratch_cap, n);
+    double *s = realloc(ts_exp_score, new_cap * sizeof(double));
+    if (!s) return 0;
+    ts_exp_score = s;
+    double *t = realloc(ts_exp_total, new_cap * sizeof(double));
+    if (!t) return 0;
+    ts_exp_total = t;
+    long *m = realloc(ts_exp_match, new_cap * sizeof(long));
+    if (!m) return 0;
+    ts_exp_match = m;
+    char *k = realloc(ts_exp_is_top, new_cap);
+    if (!k) return 0;
+    ts_exp_is_top = k;
+    ts_exp_scratch_cap = new_cap;
+  }
+  return 1;
+}
+
+/* Output buffer: grows to the largest response seen, then is reused */
+static int ts_exp_reserve(struct ts_exp_buf *b, size_t extra) {
+  if (b->failed) return 0;
+  if (b->len + extra + 1 <= b->cap) return 1;
+  size_t new_cap = b->cap ? b->cap : 65536;
+  while (new_cap < b->len + extra + 1) {
+    new_cap *= 2;
+  }
+  char *tmp = realloc(b->data, new_cap);
+  if (!tmp) {
+    b->failed = 1;
+    return 0;
+  }
+  b->data = tmp;
+  b->cap = new_cap;
+  return 1;
+}
+
+static void ts_exp_puts(struct ts_exp_buf *b, const char *s) {
+  size_t n = strlen(s);
+  if (!ts_exp_reserve(b, n)) return;
+  memcpy(b->data + b->len, s, n);
+  b->len += n;
+}
+
+static void ts_exp_printf(struct ts_exp_buf *b, const char *fmt, ...) {
+  va_list ap;
+  int n = 0;
+
+  if (!ts_exp_reserve(b, 64)) return;
+  va_start(ap, fmt);
+  n = vsnprintf(b->data + b->len, b->cap - b->len, fmt, ap);
+  va_end(ap);
+  if (n < 0) {
+    b->failed = 1;
+    return;
+  }
+  if ((size_t)n >= b->cap - b->len) {
+    if (!ts_exp_reserve(b, (size_t)n)) return;
+    va_start(ap, fmt);
+    vsnprintf(b->data + b->len, b->cap - b->len, fmt, ap);
+    va_end(ap);
+  }
+  b->len += (size_t)n;
+}
+
+/* Label values escape backslash, double quote and newline */
+static void ts_exp_label_value(struct ts_exp_buf *b, const char *s) {
+  if (!ts_exp_reserve(b, 2 * strlen(s))) return;
+  for (; *s; ++s) {
+    if (*s == '\\' || *s == '"') {
+      b->data[b->len++] = '\\';
+      b->data[b->len++] = *s;
+    } else if (*s == '\n') {
+      b->data[b->len++] = '\\';
+      b->data[b->len++] = 'n';
+    } else {
+      b->data[b->len++] = *s;
+    }
+  }
+}
+
+/* Reduce ts_driver_read_cgroup output (entries "id:controllers:path",
+ * newline- or space-separated) to the unified v2 path, else the first
+ * hierarchy's path. */
+static void ts_exp_cgroup_path(char *s) {
+  const char *path = NULL;
+
+  for (char *p = strstr(s, "0::"); p; p = strstr(p + 1, "0::")) {
+    if (p == s || p[-1] == ' ' || p[-1] == '\n') {
+      path = p + 3;
+      break;
+    }
+  }
+  if (!path) {
+    char *colon = strchr(s, ':');
+    colon = colon ? strchr(colon + 1, ':') : NULL;
+    path = colon ? colon + 1 : "";
+  }
+  size_t n = strcspn(path, " \n");
+  memmove(s, path, n);
+  s[n] = '\0';
+}
+
+/*
+ * Direct-mapped label cache. A slot is re-read from /proc only when its key
+ * changes, so steady top-N membership costs no reads per scrape.
+ */
+static const struct ts_exp_meta *ts_exp_lookup(double pid, double starttime) {
+  unsigned long long h = (unsigned long long)pid * 0x9E3779B97F4A7C15ULL;
+  h ^= (unsigned long long)starttime;
+  struct ts_exp_meta *e = &ts_exp_meta[(h ^ (h >> 29)) & ts_exp_meta_mask];
+
+  if (e->pid != pid || e->starttime != starttime) {
+    char cgroup[1024];
+    e->pid = pid;
+    e->starttime = starttime;
+    if (ts_driver_read_comm((pid_t)pid, e->comm, sizeof(e->comm)) == 0) {
+      e->comm[0] = '\0';
+    }
+    if (ts_driver_read_cgroup((pid_t)pid, cgroup, sizeof(cgroup)) == 0) {
+      cgroup[0] = '\0';
+    }
+    ts_exp_cgroup_path(cgroup);
+    snprintf(e->cgroup, sizeof(e->cgroup), "%s", cgroup);
+  }
+  return e;
+}
+
+/* Heap order: lower interval CPU first, then lower total CPU */
+static int ts_exp_less(size_t a, size_t b) {
+  if (ts_exp_score[a] != ts_exp_score[b]) {
+    return ts_exp_score[a] < ts_exp_score[b];
+  }
+  return ts_exp_total[a] < ts_exp_total[b];
+}
+
+static void ts_exp_sift_down(size_t *heap, size_t n, size_t i) {
+  for (;;) {
+    size_t l = 2 * i + 1, r = l + 1, m = i;
+    if (l < n && ts_exp_less(heap[l], heap[m])) m = l;
+    if (r < n && ts_exp_less(heap[r], heap[m])) m = r;
+    if (m == i) return;
+    size_t tmp = heap[i];
+    heap[i] = heap[m];
+    heap[m] = tmp;
+    i = m;
+  }
+}
+
+static void ts_exp_sift_up(size_t *heap, size_t i) {
+  while (i > 0) {
+    size_t p = (i - 1) / 2;
+    if (!ts_exp_less(heap[i], heap[p])) return;
+    size_t tmp = heap[i];
+    heap[i] = heap[p];
+    heap[p] = tmp;
+    i = p;
+  }
+}
+
+static int ts_exp_is_counter(size_t s) {
+  return strcmp(ts_exp_series[s].type, "counter") == 0;
+}
+
+/* Growth of series s for current row i since the previous scrape; missing
+ * (-1) values count as 0 */
+static double ts_exp_delta(size_t s, size_t i) {
+  double v = ts_exp_col(&ts_exp_curr, 2 + s)[i];
+  long j = ts_exp_match[i];
+  double before = (j >= 0) ? ts_exp_col(&ts_exp_prev, 2 + s)[j] : 0;
+  if (v < 0) return 0;
+  if (before < 0) before = 0;
+  return (v > before) ? v - before : 0;
+}
+
+static int ts_exp_cmp_index(const void *a, const void *b) {
+  size_t ia = *(const size_t *)a;
+  size_t ib = *(const size_t *)b;
+  return (ia > ib) - (ia < ib);
+}
+
+/*
+ * Match the frame against the previous scrape, rank rows by CPU since then
+ * (rows without a previous value count from birth), fold everything outside
+ * the top N into the "other" series, and keep this frame for the next call.
+ * Returns the number of top rows left in ts_exp_heap, sorted by row (and so
+ * by pid).
+ */
+static size_t ts_exp_rank(const struct ts_exp_frame *f) {
+  const double *prev_pid = ts_exp_col(&ts_exp_prev, 0);
+  const double *prev_start = ts_exp_col(&ts_exp_prev, 1);
+  double *curr_pid = ts_exp_col(&ts_exp_curr, 0);
+  double *curr_start = ts_exp_col(&ts_exp_curr, 1);
+  size_t prev_count = ts_exp_have_prev ? ts_exp_prev.count : 0;
+  size_t prev_i = 0;
+  size_t top = 0;
+
+  /* Both frames are sorted by pid: merge-match once */
+  for (size_t i = 0; i < f->count; ++i) {
+    const double *row = f->rows + i * TS_METRIC_COUNT;
+    double pid = f->pids[i];
+
+    while (prev_i < prev_count && prev_pid[prev_i] < pid) {
+      prev_i++;
+    }
+    ts_exp_match[i] = (prev_i < prev_count && prev_pid[prev_i] == pid &&
+                       prev_start[prev_i] == row[TS_STARTTIME])
+                          ? (long)prev_i
+                          : -1;
+    curr_pid[i] = pid;
+    curr_start[i] = row[TS_STARTTIME];
+    for (size_t s = 0; s < TS_EXP_SERIES; ++s) {
+      ts_exp_col(&ts_exp_curr, 2 + s)[i] = row[ts_exp_series[s].metric];
+    }
+  }
+
+  /* Interval CPU (utime + stime) picks the top N */
+  for (size_t i = 0; i < f->count; ++i) {
+    ts_exp_score[i] = 0;
+    ts_exp_total[i] = 0;
+    for (size_t s = 0; s < TS_EXP_SERIES; ++s) {
+      int metric = ts_exp_series[s].metric;
+      if (metric != TS_UTIME && metric != TS_STIME) continue;
+      ts_exp_score[i] += ts_exp_delta(s, i);
+      double v = ts_exp_col(&ts_exp_curr, 2 + s)[i];
+      ts_exp_total[i] += (v < 0) ? 0 : v;
+    }
+
+    ts_exp_is_top[i] = 0;
+    if (ts_exp_top_n == 0) continue;
+    if (top < ts_exp_top_n) {
+      ts_exp_heap[top] = i;
+      ts_exp_sift_up(ts_exp_heap, top);
+      top++;
+    } else if (ts_exp_less(ts_exp_heap[0], i)) {
+      ts_exp_heap[0] = i;
+      ts_exp_sift_down(ts_exp_heap, top, 0);
+    }
+  }
+  for (size_t k = 0; k < top; ++k) {
+    ts_exp_is_top[ts_exp_heap[k]] = 1;
+  }
+
+  /* Fold the rest into "other": counters accumulate, gauges are summed */
+  for (size_t s = 0; s < TS_EXP_SERIES; ++s) {
+    int counter = ts_exp_is_counter(s);
+    const double *col = ts_exp_col(&ts_exp_curr, 2 + s);
+    double sum = 0;
+    for (size_t i = 0; i < f->count; ++i) {
+      if (ts_exp_is_top[i]) continue;
+      if (counter) {
+        sum += ts_exp_delta(s, i);
+      } else if (col[i] > 0) {
+        sum += col[i];
+      }
+    }
+    ts_exp_other[s] = counter ? ts_exp_other[s] + sum : sum;
+  }
+
+  struct ts_exp_cols tmp = ts_exp_prev;
+  ts_exp_prev = ts_exp_curr;
+  ts_exp_curr = tmp;
+  ts_exp_prev.count = f->count;
+  ts_exp_have_prev = 1;
+
+  qsort(ts_exp_heap, top, sizeof(size_t), ts_exp_cmp_index);
+  return top;
+}
+
+/* Render the identity labels of each top row once per scrape */
+static void ts_exp_build_labels(const struct ts_exp_frame *f, size_t top) {
+  struct ts_exp_buf *b = &ts_exp_labels;
+
+  b->len = 0;
+  b->failed = 0;
+  for (size_t k = 0; k < top; ++k) {
+    size_t i = ts_exp_heap[k];
+    const struct ts_exp_meta *meta =
+        ts_exp_lookup(f->pids[i], f->rows[i * TS_METRIC_COUNT + TS_STARTTIME]);
+    ts_exp_label_off[k] = b->len;
+    ts_exp_printf(b, "pid=\"%.0f\",comm=\"", f->pids[i]);
+    ts_exp_label_value(b, meta->comm);
+    ts_exp_puts(b, "\",cgroup=\"");
+    ts_exp_label_value(b, meta->cgroup);
+    ts_exp_puts(b, "\"");
+  }
+  ts_exp_label_off[top] = b->len;
+}
+
+static void ts_exp_sample(struct ts_exp_buf *b, const struct ts_exp_series *se,
+                          const char *labels, size_t labels_len,
+                          double value) {
+  int counter = strcmp(se->type, "counter") == 0;
+
+  ts_exp_puts(b, se->name);
+  ts_exp_puts(b, counter ? "_total{" : "{");
+  if (!ts_exp_reserve(b, labels_len)) return;
+  memcpy(b->data + b->len, labels, labels_len);
+  b->len += labels_len;
+  if (se->label) {
+    ts_exp_puts(b, ",");
+    ts_exp_puts(b, se->label);
+  }
+  ts_exp_printf(b, "} %.15g\n", value * se->scale);
+}
+
+/* OpenMetrics text for the ranked frame, family by family */
+static void ts_exp_encode(const struct ts_exp_frame *f, size_t top) {
+  struct ts_exp_buf *b = &ts_exp_body;
+  static const char other[] = "comm=\"other\"";
+  const char *family = NULL;
+
+  b->len = 0;
+  b->failed = 0;
+  ts_exp_puts(b, "# TYPE tensorscan_processes gauge\n"
+                 "# HELP tensorscan_processes Processes in the latest frame.\n");
+  ts_exp_printf(b, "tensorscan_processes %zu\n", f->count);
+
+  for (size_t s = 0; s < TS_EXP_SERIES; ++s) {
+    const struct ts_exp_series *se = &ts_exp_series[s];
+    if (!family || strcmp(family, se->name) != 0) {
+      family = se->name;
+      ts_exp_printf(b, "# TYPE %s %s\n", family, se->type);
+      if (se->unit) ts_exp_printf(b, "# UNIT %s %s\n", family, se->unit);
+      ts_exp_printf(b, "# HELP %s %s\n", family, se->help);
+    }
+    for (size_t k = 0; k < top; ++k) {
+      size_t i = ts_exp_heap[k];
+      double v = f->rows[i * TS_METRIC_COUNT + se->metric];
+      if (v < 0) continue;
+      ts_exp_sample(b, se, ts_exp_labels.data + ts_exp_label_off[k],
+                    ts_exp_label_off[k + 1] - ts_exp_label_off[k], v);
+    }
+    ts_exp_sample(b, se, other, sizeof(other) - 1, ts_exp_other[s]);
+  }
+  ts_exp_puts(b, "# EOF\n");
+}
+
+/*
+ * Bring ts_exp_body up to date. Published frames are encoded once; scrapes
+ * between two publishes reuse the same body. Returns 0 on allocation failure.
+ */
+static int ts_exp_refresh(void) {
+  if (ts_exp_capture) {
+    struct ts_layout layout = {TS_METRIC_COUNT, 1, NULL, NULL};
+    size_t count = 0;
+    if (!ts_exp_frame_reserve(&ts_exp_work, 1)) return 0;
+    for (;;) {
+      count = ts_driver_capture_absolute(ts_exp_work.rows, ts_exp_work.cap,
+                                         &layout, ts_exp_work.pids, NULL);
+      if (count <= ts_exp_work.cap) break;
+      if (!ts_exp_frame_reserve(&ts_exp_work, count + count / 8)) return 0;
+    }
+    ts_exp_work.count = count;
+  } else {
+    int fresh = 0;
+    pthread_mutex_lock(&ts_exp_lock);
+    if (ts_exp_seq != ts_exp_seen) {
+      struct ts_exp_frame tmp = ts_exp_work;
+      ts_exp_work = ts_exp_latest;
+      ts_exp_latest = tmp;
+      ts_exp_seen = ts_exp_seq;
+      fresh = 1;
+    }
+    pthread_mutex_unlock(&ts_exp_lock);
+    if (!fresh && ts_exp_body.len > 0) return 1;
+  }
+
+  if (!ts_exp_reserve_rows(ts_exp_work.count)) return 0;
+  size_t top = ts_exp_rank(&ts_exp_work);
+  ts_exp_build_labels(&ts_exp_work, top);
+  ts_exp_encode(&ts_exp_work, top);
+  return !ts_exp_labels.failed && !ts_exp_body.failed;
+}
+
+static int ts_exp_send_all(int fd, const char *data, size_t len) {
+  while (len > 0) {
+    ssize_t n = send(fd, data, len, MSG_NOSIGNAL);
+    if (n < 0) {
+      if (errno == EINTR) continue;
+      return 0;
+    }
+    data += n;
+    len -= (size_t)n;
+  }
+  return 1;
+}
+
+/* Minimal HTTP/1.1: GET or HEAD of / or /metrics, one request per connection */
+static void ts_exp_serve(int fd) {
+  char req[TS_EXP_REQ_MAX];
+  char head[256];
+  size_t len = 0;
+  struct timeval tv = {1, 0};
+  const char *status = "200 OK";
+  const char *path = NULL;
+  int head_only = 0;
+
+  setsockopt(fd, SOL_SOCKET, SO_RCVTIMEO, &tv, sizeof(tv));
+  setsockopt(fd, SOL_SOCKET, SO_SNDTIMEO, &tv, sizeof(tv));
+  req[0] = '\0';
+  while (len < sizeof(req) - 1 && !strstr(req, "\r\n\r\n") &&
+         !strstr(req, "\n\n")) {
+    ssize_t n = recv(fd, req + len, sizeof(req) - 1 - len, 0);
+    if (n <= 0) break;
+    len += (size_t)n;
+    req[len] = '\0';
+  }
+
+  if (strncmp(req, "GET ", 4) == 0) {
+    path = req + 4;
+  } else if (strncmp(req, "HEAD ", 5) == 0) {
+    path = req + 5;
+    head_only = 1;
+  } else {
+    status = "405 Method Not Allowed";
+  }
+  if (path) {
+    size_t n = strcspn(path, " ?");
+    if (!((n == 1 && path[0] == '/') ||
+          (n == 8 && strncmp(path, "/metrics", 8) == 0))) {
+      status = "404 Not Found";
+    } else if (!ts_exp_refresh()) {
+      status = "500 Internal Server Error";
+    }
+  }
+
+  if (strcmp(status, "200 OK") == 0) {
+    snprintf(head, sizeof(head),
+             "HTTP/1.1 200 OK\r\n"
+             "Content-Type: application/openmetrics-text; version=1.0.0; "
+             "charset=utf-8\r\n"
+             "Content-Length: %zu\r\nConnection: close\r\n\r\n",
+             ts_exp_body.len);
+    if (ts_exp_send_all(fd, head, strlen(head)) && !head_only) {
+      ts_exp_send_all(fd, ts_exp_body.data, ts_exp_body.len);
+    }
+  } else {
+    snprintf(head, sizeof(head),
+             "HTTP/1.1 %s\r\nContent-Length: 0\r\nConnection: close\r\n\r\n",
+             status);
+    ts_exp_send_all(fd, head, strlen(head));
+  }
+}
+
+static void *ts_exp_main(void *arg) {
+  struct pollfd fds[2];
+
+  (void)arg;
+  fds[0].fd = ts_exp_listen;
+  fds[0].events = POLLIN;
+  fds[1].fd = ts_exp_wake[0];
+  fds[1].events = POLLIN;
+
+  for (;;) {
+    if (poll(fds, 2, -1) < 0) {
+      if (errno == EINTR) continue;
+      break;
+    }
+    if (fds[1].revents) break;
+    if (!(fds[0].revents & POLLIN)) continue;
+
+    int fd = accept(ts_exp_listen, NULL, NULL);
+    if (fd < 0) continue;
+    ts_exp_cloexec(fd);
+    ts_exp_serve(fd);
+    close(fd);
+  }
+
+  /* Self-capture used this thread's driver buffers */
+  ts_driver_free_thread_resources();
+  return NULL;
+}
+
+/* "unix:<path>", "<port>", "127.0.0.1:<port>" or "localhost:<port>" */
+/* 1 unless connecting to the unix socket at sa is refused, i.e. nothing
+ * listens there any more. */
+static int ts_exp_unix_live(const struct sockaddr_un *sa) {
+  int fd = socket(AF_UNIX, SOCK_STREAM, 0);
+  int live = 1;
+
+  if (fd < 0) return 1;
+  if (connect(fd, (const struct sockaddr *)sa, sizeof(*sa)) < 0 &&
+      errno == ECONNREFUSED) {
+    live = 0;
+  }
+  close(fd);
+  return live;
+}
+
+static int ts_exp_open(const char *addr) {
+  int fd = -1;
+
+  if (strncmp(addr, "unix:", 5) == 0) {
+    struct sockaddr_un sa;
+    struct stat st;
+    const char *path = addr + 5;
+
+    if (*path == '\0' || strlen(path) >= sizeof(sa.sun_path)) return -1;
+    memset(&sa, 0, sizeof(sa));
+    sa.sun_family = AF_UNIX;
+    memcpy(sa.sun_path, path, strlen(path));
+
+    /* Replace a stale socket from an earlier run, never a regular file and
+     * never one a running instance still serves */
+    if (lstat(path, &st) == 0 && S_ISSOCK(st.st_mode)) {
+      if (ts_exp_unix_live(&sa)) return -1;
+      unlink(path);
+    }
+
+    fd = socket(AF_UNIX, SOCK_STREAM, 0);
+    if (fd < 0) return -1;
+    /* Owner-only from the start: Linux creates the socket file with the
+     * socket inode's mode, and umask would race other threads. The chmod
+     * after bind covers systems that ignore fchmod on sockets. */
+    fchmod(fd, S_IRUSR | S_IWUSR);
+    if (bind(fd, (struct sockaddr *)&sa, sizeof(sa)) < 0) {
+      close(fd);
+      return -1;
+    }
+    if (chmod(path, S_IRUSR | S_IWUSR) < 0) {
+      unlink(path);
+      close(fd);
+      return -1;
+    }
+    snprintf(ts_exp_unix_path, sizeof(ts_exp_unix_path), "%s", path);
+  } else {
+    struct sockaddr_in sa;
+    const char *port = strrchr(addr, ':');
+    char *end = NULL;
+    long num = 0;
+    int one = 1;
+
+    if (port) {
+      size_t host_len = (size_t)(port - addr);
+      if (!((host_len == 9 && strncmp(addr, "127.0.0.1", 9) == 0) ||
+            (host_len == 9 && strncmp(addr, "localhost", 9) == 0))) {
+        return -1;
+      }
+      port++;
+    } else {
+      port = addr;
+    }
+    errno = 0;
+    num = strtol(port, &end, 10);
+    if (errno != 0 || end == port || *end != '\0' || num <= 0 ||
+        num > 65535) {
+      return -1;
+    }
+
+    memset(&sa, 0, sizeof(sa));
+    sa.sin_family = AF_INET;
+    sa.sin_port = htons((unsigned short)num);
+    sa.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+    fd = socket(AF_INET, SOCK_STREAM, 0);
+    if (fd < 0) return -1;
+    setsockopt(fd, SOL_SOCKET, SO_REUSEADDR, &one, sizeof(one));
+    if (bind(fd, (struct sockaddr *)&sa, sizeof(sa)) < 0) {
+      close(fd);
+      return -1;
+    }
+  }
+
+  if (!ts_exp_cloexec(fd) || listen(fd, 16) < 0) {
+    close(fd);
+    if (ts_exp_unix_path[0]) unlink(ts_exp_unix_path);
+    ts_exp_unix_path[0] = '\0';
+    return -1;
+  }
+  return fd;
+}
+
+static void ts_exp_release(void) {
+  if (ts_exp_listen >= 0) close(ts_exp_listen);
+  if (ts_exp_wake[0] >= 0) close(ts_exp_wake[0]);
+  if (ts_exp_wake[1] >= 0) close(ts_exp_wake[1]);
+  ts_exp_listen = -1;
+  ts_exp_wake[0] = ts_exp_wake[1] = -1;
+  if (ts_exp_unix_path[0]) unlink(ts_exp_unix_path);
+  ts_exp_unix_path[0] = '\0';
+
+  ts_exp_frame_free(&ts_exp_work);
+  pthread_mutex_lock(&ts_exp_lock);
+  ts_exp_accepting = 0;
+  ts_exp_frame_free(&ts_exp_latest);
+  pthread_mutex_unlock(&ts_exp_lock);
+  free(ts_exp_prev.data);
+  free(ts_exp_curr.data);
+  memset(&ts_exp_prev, 0, sizeof(ts_exp_prev));
+  memset(&ts_exp_curr, 0, sizeof(ts_exp_curr));
+  free(ts_exp_score);
+  free(ts_exp_total);
+  free(ts_exp_match);
+  free(ts_exp_is_top);
+  ts_exp_score = ts_exp_total = NULL;
+  ts_exp_match = NULL;
+  ts_exp_is_top = NULL;
+  ts_exp_scratch_cap = 0;
+  free(ts_exp_heap);
+  free(ts_exp_meta);
+  free(ts_exp_label_off);
+  free(ts_exp_labels.data);
+  free(ts_exp_body.data);
+  ts_exp_heap = NULL;
+  ts_exp_meta = NULL;
+  ts_exp_label_off = NULL;
+  memset(&ts_exp_labels, 0, sizeof(ts_exp_labels));
+  memset(&ts_exp_body, 0, sizeof(ts_exp_body));
+}
+
+int ts_exporter_start(const char *addr, size_t top_n, int capture_on_scrape) {
+  size_t slots = 64;
+  int ok = 0;
+
+  if (!addr) return 0;
+
+  pthread_mutex_lock(&ts_exp_ctl);
+  if (ts_exp_running) {
+    pthread_mutex_unlock(&ts_exp_ctl);
+    return 1;
+  }
+
+  while (slots < 4 * top_n) {
+    slots *= 2;
+  }
+  ts_exp_top_n = top_n;
+  ts_exp_capture = capture_on_scrape != 0;
+  ts_exp_have_prev = 0;
+  ts_exp_seen = 0;
+  memset(ts_exp_other, 0, sizeof(ts_exp_other));
+  ts_exp_heap = malloc((top_n ? top_n : 1) * sizeof(size_t));
+  ts_exp_label_off = malloc((top_n + 1) * sizeof(size_t));
+  ts_exp_meta = calloc(slots, sizeof(struct ts_exp_meta));
+  ts_exp_meta_mask = slots - 1;
+  ok = ts_exp_heap && ts_exp_label_off && ts_exp_meta;
+  if (ok) {
+    /* pid 0 never occurs, so zeroed slots read as empty */
+    ok = pipe(ts_exp_wake) == 0;
+    if (!ok) ts_exp_wake[0] = ts_exp_wake[1] = -1;
+  }
+  if (ok) ok = ts_exp_cloexec(ts_exp_wake[0]) && ts_exp_cloexec(ts_exp_wake[1]);
+  if (ok) ok = (ts_exp_listen = ts_exp_open(addr)) >= 0;
+  if (ok) ok = pthread_create(&ts_exp_thread, NULL, ts_exp_main, NULL) == 0;
+
+  if (ok) {
+    ts_exp_running = 1;
+    pthread_mutex_lock(&ts_exp_lock);
+    ts_exp_accepting = 1;
+    pthread_mutex_unlock(&ts_exp_lock);
+  } else {
+    ts_exp_release();
+  }
+  pthread_mutex_unlock(&ts_exp_ctl);
+  return ok;
+}
+
+void ts_exporter_stop(size_t ignored) {
+  char byte = 0;
+
+  (void)ignored;
+  pthread_mutex_lock(&ts_exp_ctl);
+  if (ts_exp_running) {
+    while (write(ts_exp_wake[1], &byte, 1) < 0 && errno == EINTR) {
+    }
+    pthread_join(ts_exp_thread, NULL);
+    ts_exp_release();
+    ts_exp_running = 0;
+  }
+  pthread_mutex_unlock(&ts_exp_ctl);
+}
+
+size_t ts_exporter_publish(const double *frame, size_t rows, size_t max_cols,
+                           const double *pids) {
+  if (!frame || !pids || max_cols < TS_METRIC_COUNT) return 0;
+
+  pthread_mutex_lock(&ts_exp_lock);
+  if (!ts_exp_accepting || !ts_exp_frame_reserve(&ts_exp_latest, rows)) {
+    pthread_mutex_unlock(&ts_exp_lock);
+    return 0;
+  }
+  for (size_t i = 0; i < rows; ++i) {
+    memcpy(ts_exp_latest.rows + i * TS_METRIC_COUNT, frame + i * max_cols,
+           TS_METRIC_COUNT * sizeof(double));
+  }
+  memcpy(ts_exp_latest.pids, pids, rows * sizeof(double));
+  ts_exp_latest.count = rows;
+  ts_exp_seq++;
+  pthread_mutex_unlock(&ts_exp_lock);
+  return rows;
+}
@@ -5,41 +5,242 @@
 #include <string.h>
 #include <stdio.h>
 #include <stdlib.h>
+#include <unistd.h>
 
-/* Delta Logic State */
-struct ts_prev_row {
-  double pid;
-  double starttime;
-  double metrics[TS_METRIC_COUNT];
+/* Delta Logic State: one column per field so counter deltas run as tight
+ * loops over a column. Column 0 is pid, 1 is starttime, 2 + m is metric m. */
+#define TS_FRAME_COLS (2 + TS_METRIC_COUNT)
+
+struct ts_frame_cols {
+  double *data;
+  size_t cap;
+  size_t count;
+};
+
+struct ts_delta_state {
+  struct ts_frame_cols prev;
+  struct ts_frame_cols curr;
+  long *match;     /* prev row per current row, -1 when unmatched */
+  double *aligned; /* prev counter column gathered into current row order */
+  size_t scratch_cap;
+};
+
+static const int ts_counter_metrics[] = {
+    TS_UTIME, TS_STIME, TS_VOL_CTX_SWITCHES, TS_NONVOL_CTX_SWITCHES,
+    TS_IO_READ_BYTES, TS_IO_WRITE_BYTES, TS_MINFLT, TS_MAJFLT};
+#define TS_COUNTER_COUNT \
+  (sizeof(ts_counter_metrics) / sizeof(ts_counter_metrics[0]))
+
+static __thread struct ts_delta_state ts_delta;
+static __thread struct ts_delta_state ts_task_delta;
+
+/* Sparse (COO) delta state: its own previous frame plus a metric-major
+ * capture scratch of TS_METRIC_COUNT columns of ts_coo_cap entries. */
+static __thread struct ts_delta_state ts_coo;
+static __thread double *ts_coo_cols = NULL;
+static __thread double *ts_coo_pids = NULL;
+static __thread size_t ts_coo_cap = 0;
+static __thread size_t ts_coo_rows = 0; /* rows of the last committed frame */
+
+/* Adaptive sampling state: identities sorted by pid, one column per field.
+ * Column 0 is pid, 1 starttime, 2 period and 3 frames left until the next
+ * read, 4 the time of the last read, 5 + m metric m as last read. */
+#define TS_ADAPT_PERIOD 2
+#define TS_ADAPT_WAIT 3
+#define TS_ADAPT_READ_AT 4
+#define TS_ADAPT_COLS (5 + TS_METRIC_COUNT)
+#define TS_ADAPT_MAX_PERIOD 16
+
+static __thread struct ts_frame_cols ts_adapt_prev;
+static __thread struct ts_frame_cols ts_adapt_curr;
+static __thread unsigned long long ts_adapt_frame = 0;
+
+/* Typed Output State: int32 values clamped by the last typed encode on
+ * this thread. Rows are encoded as the driver produces them; nothing is
+ * staged as float64 on the way. */
+static __thread size_t ts_typed_clamped = 0;
+
+/* Where a typed capture writes: put_row context for ts_snapshot_typed */
+struct ts_typed_sink {
+  unsigned char *out;
+  size_t row_bytes;
+  size_t max_cols;
+  const double *types;
+  const double *scales;
+  int32_t *pid_out;
 };
 
-static __thread struct ts_prev_row *ts_prev_rows = NULL;
-static __thread size_t ts_prev_cap = 0;
-static __thread size_t ts_prev_count = 0;
-static __thread struct ts_prev_row *ts_curr_rows = NULL;
-static __thread size_t ts_curr_cap = 0;
+static double *ts_frame_col(const struct ts_frame_cols *frame, size_t col) {
+  return frame->data + (col * frame->cap);
+}
 
-static int ts_ensure_rows_capacity(struct ts_prev_row **rows, size_t *cap,
-                                   size_t needed) {
-  if (needed <= *cap) {
+/* Grow a column frame of 'ncols' columns; old contents are not kept. */
+static int ts_ensure_columns(struct ts_frame_cols *frame, size_t ncols,
+                             size_t needed) {
+  if (needed <= frame->cap) {
     return 1;
   }
-  size_t new_cap = *cap ? *cap : 1024;
+  size_t new_cap = frame->cap ? frame->cap : 1024;
   while (new_cap < needed) {
     new_cap *= 2;
   }
-  struct ts_prev_row *tmp = realloc(*rows, new_cap * sizeof(*tmp));
+  double *tmp = realloc(frame->data, new_cap * ncols * sizeof(*tmp));
   if (!tmp) {
     return 0;
   }
-  *rows = tmp;
-  *cap = new_cap;
+  /* Column offsets move with the capacity */
+  frame->data = tmp;
+  frame->cap = new_cap;
+  frame->count = 0;
   return 1;
 }
 
+static int ts_ensure_frame_capacity(struct ts_frame_cols *frame,
+                                    size_t needed) {
+  return ts_ensure_columns(frame, TS_FRAME_COLS, needed);
+}
+
+static int ts_ensure_delta_scratch(struct ts_delta_state *st, size_t needed) {
+  if (needed <= st->scratch_cap) {
+    return 1;
+  }
+  size_t new_cap = st->scratch_cap ? st->scratch_cap : 1024;
+  while (new_cap < needed) {
+    new_cap *= 2;
+  }
+  long *match = realloc(st->match, new_cap * sizeof(*match));
+  if (!match) {
+    return 0;
+  }
+  st->match = match;
+  double *aligned = realloc(st->aligned, new_cap * sizeof(*aligned));
+  if (!aligned) {
+    return 0;
+  }
+  st->aligned = aligned;
+  st->scratch_cap = new_cap;
+  return 1;
+}
+
+static void ts_delta_state_free(struct ts_delta_state *st) {
+  free(st->prev.data);
+  free(st->curr.data);
+  free(st->match);
+  free(st->aligned);
+  memset(st, 0, sizeof(*st));
+}
+
+/*
+ * Replace the counter columns of 'rows' freshly captured rows with deltas
+ * against the previous frame held in 'st', then keep the absolute values for
+ * the next call. Returns 0 on allocation failure.
+ */
+static int ts_delta_apply(struct ts_delta_state *st, double *out, size_t rows,
+                          const struct ts_layout *layout,
+                          const double *pid_out) {
+  size_t rs = layout->row_stride;
+  size_t cs = layout->col_stride;
+
+  if (!ts_ensure_frame_capacity(&st->curr, rows) ||
+      !ts_ensure_delta_scratch(st, rows)) {
+    return 0;
+  }
+
+  const double *prev_pid = ts_frame_col(&st->prev, 0);
+  const double *prev_start = ts_frame_col(&st->prev, 1);
+  double *curr_pid = ts_frame_col(&st->curr, 0);
+  double *curr_start = ts_frame_col(&st->curr, 1);
+  const double *start_col = out + (TS_STARTTIME * cs);
+  size_t prev_count = st->prev.count;
+  size_t prev_i = 0;
+
+  /* Both frames are sorted by PID (driver guarantees sort): merge-match once */
+  for (size_t i = 0; i < rows; ++i) {
+    double pid = pid_out[i];
+    double starttime = start_col[i * rs];
+    curr_pid[i] = pid;
+    curr_start[i] = starttime;
+    while (prev_i < prev_count && prev_pid[prev_i] < pid) {
+      prev_i++;
+    }
+    st->match[i] = (prev_i < prev_count && prev_pid[prev_i] == pid &&
+                    prev_start[prev_i] == starttime)
+                       ? (long)prev_i
+                       : -1;
+  }
+
+  /* Keep absolute values for the next frame */
+  for (size_t m = 0; m < TS_METRIC_COUNT; ++m) {
+    const double *src = out + (m * cs);
+    double *dst = ts_frame_col(&st->curr, 2 + m);
+    for (size_t i = 0; i < rows; ++i) {
+      dst[i] = src[i * rs];
+    }
+  }
+
+  /* Counter deltas, one column at a time. Unmatched rows gather -1 so they
+   * take the same path as a missing previous value. */
+  for (size_t c = 0; c < TS_COUNTER_COUNT; ++c) {
+    int idx = ts_counter_metrics[c];
+    const double *prev_col = ts_frame_col(&st->prev, 2 + idx);
+    double *col = out + (idx * cs);
+
+    for (size_t i = 0; i < rows; ++i) {
+      st->aligned[i] = (st->match[i] >= 0) ? prev_col[st->match[i]] : -1;
+    }
+    for (size_t i = 0; i < rows; ++i) {
+      double curr = col[i * rs];
+      double prev = st->aligned[i];
+      double delta = curr - prev;
+      delta = (delta < 0) ? 0 : delta;
+      delta = (prev < 0) ? 0 : delta;
+      col[i * rs] = (curr < 0) ? -1 : delta;
+    }
+  }
+
+  /* Swap frames */
+  struct ts_frame_cols tmp = st->prev;
+  st->prev = st->curr;
+  st->curr = tmp;
+  st->prev.count = rows;
+  return 1;
+}
+
+static struct ts_layout ts_row_major(size_t max_cols) {
+  struct ts_layout layout;
+  layout.row_stride = max_cols;
+  layout.col_stride = 1;
+  layout.put_row = NULL;
+  layout.ctx = NULL;
+  return layout;
+}
+
+static struct ts_layout ts_metric_major(size_t col_stride) {
+  struct ts_layout layout;
+  layout.row_stride = 1;
+  layout.col_stride = col_stride;
+  layout.put_row = NULL;
+  layout.ctx = NULL;
+  return layout;
+}
+
+void ts_layout_put(const struct ts_layout *layout, double *out, size_t row,
+                   double id, const double *metrics) {
+  if (layout->put_row) {
+    layout->put_row(layout, row, id, metrics);
+    return;
+  }
+  double *row_ptr = out + (row * layout->row_stride);
+  for (size_t m = 0; m < TS_METRIC_COUNT; ++m) {
+    row_ptr[m * layout->col_stride] = metrics[m];
+  }
+}
+
 size_t ts_snapshot(double *out, size_t max_rows, size_t max_cols,
                     double *pid_out) {
-  return ts_driver_capture_absolute(out, max_rows, max_cols, pid_out, NULL);
+  if (max_cols < TS_METRIC_COUNT) return 0;
+  struct ts_layout layout = ts_row_major(max_cols);
+  return ts_driver_capture_absolute(out, max_rows, &layout, pid_out, NULL);
 }
 
 size_t ts_snapshot_filtered(double *out, size_t max_rows, size_t max_cols,
@@ -47,140 +248,682 @@ size_t ts_snapshot_filtered(double *out, size_t max_rows, size_t max_cols,
                              const double *pid_whitelist,
                              size_t whitelist_count, double only_uid) {
   struct ts_filter filter;
+  struct ts_compiled_filter *whitelist = NULL;
   filter.pid_min = pid_min;
   filter.pid_max = pid_max;
   filter.only_uid = only_uid;
-  filter.pid_whitelist = pid_whitelist;
-  filter.whitelist_count = whitelist_count;
+  filter.compiled = NULL;
+
+  if (max_cols < TS_METRIC_COUNT) return 0;
+
+  /* The whitelist becomes a compiled pid set, so each pid is one probe */
+  if (pid_whitelist && whitelist_count > 0) {
+    whitelist = ts_filter_create(0);
+    if (!whitelist ||
+        !ts_filter_add_pids(whitelist, pid_whitelist, whitelist_count) ||
+        !ts_filter_compile(whitelist)) {
+      ts_filter_destroy(whitelist);
+      return 0;
+    }
+    filter.compiled = whitelist;
+  }
 
-  return ts_driver_capture_absolute(out, max_rows, max_cols, pid_out, &filter);
+  struct ts_layout layout = ts_row_major(max_cols);
+  size_t count =
+      ts_driver_capture_absolute(out, max_rows, &layout, pid_out, &filter);
+  ts_filter_destroy(whitelist);
+  return count;
 }
 
-size_t ts_snapshot_delta(double *out, size_t max_rows, size_t max_cols,
-                          double *pid_out) {
-  /* 
-   * Buffer Strategy:
-   * 1. Capture current absolute snapshot into a temp buffer (or directly if filtering is tricky).
-   *    Since we need to match PIDs, we'll allocate a temporary buffer for the raw capture.
-   *    However, to avoid large mallocs on every frame, we can reuse 'ts_curr_rows'.
-   *    But 'ts_curr_rows' is structured. The driver writes to flat double arrays.
-   *    So we simply call the driver with a pointer to a scratch buffer?
-   *    Better: Let's allocate a scratch flat buffer.
-   */
-  
-  /* For simplicity in this FFI layer, we will capture to a large static thread-local buffer?
-   * No, that's unsafe for size. We'll malloc a buffer for the raw snapshot.
-   * Or better, we can just use the user-provided 'out' buffer for the raw capture,
-   * then process it in-place? 
-   * No, 'out' is likely 'max_rows' which might be smaller than total system PIDs.
-   * The driver truncates. This is fine. We only delta what we captured.
-   */
+static struct ts_filter ts_compiled_only(const struct ts_compiled_filter *f) {
+  struct ts_filter filter;
+  filter.pid_min = -1;
+  filter.pid_max = -1;
+  filter.only_uid = -1;
+  filter.compiled = f;
+  return filter;
+}
+
+size_t ts_snapshot_compiled(double *out, size_t max_rows, size_t max_cols,
+                            double *pid_out,
+                            const struct ts_compiled_filter *filter) {
+  if (max_cols < TS_METRIC_COUNT) return 0;
+  struct ts_filter wrapped = ts_compiled_only(filter);
+  struct ts_layout layout = ts_row_major(max_cols);
+  return ts_driver_capture_absolute(out, max_rows, &layout, pid_out, &wrapped);
+}
 
+/* Shared delta path for row-major and metric-major output. */
+static size_t ts_snapshot_delta_layout(double *out, size_t max_rows,
+                                       const struct ts_layout *layout,
+                                       double *pid_out,
+                                       const struct ts_filter *filter) {
   if (!pid_out) {
-    ts_prev_count = 0;
+    ts_delta.prev.count = 0;
     return 0;
   }
 
-  /* Capturing absolute metrics first */
-  size_t count = ts_driver_capture_absolute(out, max_rows, max_cols, pid_out, NULL);
+  /* Capturing absolute metrics first; the driver truncates to max_rows and
+   * we only delta what we captured. */
+  size_t count = ts_driver_capture_absolute(out, max_rows, layout, pid_out, filter);
 
-  if (count == 0 || max_cols < TS_METRIC_COUNT) return 0;
+  if (count == 0) return 0;
 
   size_t rows = count;
   if (rows > max_rows) {
     rows = max_rows;
   }
   if (rows == 0) {
-    ts_prev_count = 0;
+    ts_delta.prev.count = 0;
     return count;
   }
 
-  /* Ensure capacity for CURRENT rows (structured) */
-  if (!ts_ensure_rows_capacity(&ts_curr_rows, &ts_curr_cap, rows)) {
-      /* Memory failure fallback: Return 0 to avoid reporting spikes from absolute values */
-      return 0;
+  if (!ts_delta_apply(&ts_delta, out, rows, layout, pid_out)) {
+    /* Memory failure fallback: Return 0 to avoid reporting spikes from absolute values */
+    return 0;
   }
-  
-  size_t processed_count = 0;
-  size_t prev_i = 0;
+  return count;
+}
 
-  for (size_t i = 0; i < rows; ++i) {
-    double *row_ptr = out + (i * max_cols);
-    double pid = pid_out[i];
-    double starttime = row_ptr[TS_STARTTIME];
+size_t ts_snapshot_delta(double *out, size_t max_rows, size_t max_cols,
+                          double *pid_out) {
+  if (max_cols < TS_METRIC_COUNT) return 0;
+  struct ts_layout layout = ts_row_major(max_cols);
+  return ts_snapshot_delta_layout(out, max_rows, &layout, pid_out, NULL);
+}
 
-    /* Store current for next time */
-    ts_curr_rows[processed_count].pid = pid;
-    ts_curr_rows[processed_count].starttime = starttime;
-    for (size_t m = 0; m < TS_METRIC_COUNT; ++m) {
-      ts_curr_rows[processed_count].metrics[m] = row_ptr[m];
-    }
+size_t ts_snapshot_delta_compiled(double *out, size_t max_rows,
+                                  size_t max_cols, double *pid_out,
+                                  const struct ts_compiled_filter *filter) {
+  if (max_cols < TS_METRIC_COUNT) return 0;
+  struct ts_filter wrapped = ts_compiled_only(filter);
+  struct ts_layout layout = ts_row_major(max_cols);
+  return ts_snapshot_delta_layout(out, max_rows, &layout, pid_out, &wrapped);
+}
+
+size_t ts_snapshot_columns(double *out, size_t max_rows, size_t col_stride,
+                           double *pid_out) {
+  if (col_stride < max_rows) return 0;
+  struct ts_layout layout = ts_metric_major(col_stride);
+  return ts_driver_capture_absolute(out, max_rows, &layout, pid_out, NULL);
+}
+
+size_t ts_snapshot_delta_columns(double *out, size_t max_rows,
+                                 size_t col_stride, double *pid_out) {
+  if (col_stride < max_rows) return 0;
+  struct ts_layout layout = ts_metric_major(col_stride);
+  return ts_snapshot_delta_layout(out, max_rows, &layout, pid_out, NULL);
+}
+
+size_t ts_snapshot_threads(double *out, size_t max_rows, size_t max_cols,
+                           double *tgid_out, double *tid_out,
+                           const struct ts_compiled_filter *filter) {
+  if (max_cols < TS_METRIC_COUNT) return 0;
+  struct ts_filter wrapped = ts_compiled_only(filter);
+  struct ts_layout layout = ts_row_major(max_cols);
+  return ts_driver_capture_threads(out, max_rows, &layout, tgid_out, tid_out,
+                                   filter ? &wrapped : NULL);
+}
+
+size_t ts_snapshot_delta_threads(double *out, size_t max_rows, size_t max_cols,
+                                 double *tgid_out, double *tid_out,
+                                 const struct ts_compiled_filter *filter) {
+  if (!tid_out) {
+    ts_task_delta.prev.count = 0;
+    return 0;
+  }
+
+  size_t count = ts_snapshot_threads(out, max_rows, max_cols, tgid_out,
+                                     tid_out, filter);
+  if (count == 0) return 0;
+
+  size_t rows = (count < max_rows) ? count : max_rows;
+  if (rows == 0) {
+    ts_task_delta.prev.count = 0;
+    return count;
+  }
+
+  /* Rows are sorted by tid, so the tid plays the pid role in matching */
+  struct ts_layout layout = ts_row_major(max_cols);
+  if (!ts_delta_apply(&ts_task_delta, out, rows, &layout, tid_out)) {
+    return 0;
+  }
+  return count;
+}
+
+/*
+ * Copy one adaptive identity from row j of prev (or a fresh read when
+ * j < 0) into row i of curr, and emit its output row. Returns 1 if the row
+ * is active (any counter grew).
+ */
+static int ts_adapt_emit(size_t i, long j, const double *metrics, int fresh,
+                         double now, double *row_ptr, double *stale,
+                         double *span) {
+  const struct ts_frame_cols *prev = &ts_adapt_prev;
+  struct ts_frame_cols *curr = &ts_adapt_curr;
+  int active = 0;
+
+  for (size_t m = 0; m < TS_METRIC_COUNT; ++m) {
+    double v = fresh ? metrics[m] : ts_frame_col(prev, 5 + m)[j];
+    ts_frame_col(curr, 5 + m)[i] = v;
+    if (row_ptr) row_ptr[m] = v;
+  }
+
+  for (size_t c = 0; c < TS_COUNTER_COUNT; ++c) {
+    int idx = ts_counter_metrics[c];
+    double v = fresh ? metrics[idx] : ts_frame_col(prev, 5 + idx)[j];
+    double before = (fresh && j >= 0) ? ts_frame_col(prev, 5 + idx)[j] : -1;
+    double delta = (v < 0) ? -1 : (before < 0) ? 0 : v - before;
+    if (delta < 0 && v >= 0) delta = 0;
+    if (delta > 0) active = 1;
+    /* Stale rows report no counter growth; the next read covers the gap */
+    if (row_ptr) row_ptr[idx] = fresh ? delta : ((v < 0) ? -1 : 0);
+  }
+
+  if (stale) *stale = fresh ? 0 : 1;
+  if (span) {
+    *span = (fresh && j >= 0) ? now - ts_frame_col(prev, TS_ADAPT_READ_AT)[j]
+                              : 0;
+  }
+  return active;
+}
+
+/*
+ * Frames from now until an identity with this period is next due. Each
+ * identity is due when (frame + phase) % period == 0, with the phase hashed
+ * from pid and starttime, so idle identities that backed off together are
+ * spread over the period instead of all being re-read on the same frame.
+ */
+static double ts_adapt_wait(double pid, double starttime, double period) {
+  unsigned long long p = (unsigned long long)period;
+  unsigned long long h = (unsigned long long)pid * 0x9E3779B97F4A7C15ULL;
+  h ^= (unsigned long long)(starttime / 1e6) * 0xC2B2AE3D27D4EB4FULL;
+  h ^= h >> 29;
+  return (double)(p - (ts_adapt_frame + h) % p);
+}
+
+size_t ts_snapshot_delta_adaptive(double *out, size_t max_rows,
+                                  size_t max_cols, double *pid_out,
+                                  double *stale_out, double *span_out) {
+  const pid_t *pids = NULL;
+  size_t row = 0;
+
+  if (!pid_out) {
+    ts_adapt_prev.count = 0;
+    ts_adapt_frame = 0;
+    return 0;
+  }
+  if (max_cols < TS_METRIC_COUNT || !out) return 0;
+
+  double now = ts_get_monotonic_time(0);
+  ts_adapt_frame++;
+  size_t count = ts_driver_list_pids(&pids);
+  if (!ts_ensure_columns(&ts_adapt_curr, TS_ADAPT_COLS, count)) return 0;
+
+  struct ts_frame_cols *prev = &ts_adapt_prev;
+  struct ts_frame_cols *curr = &ts_adapt_curr;
+  const double *prev_pid = ts_frame_col(prev, 0);
+  const double *prev_start = ts_frame_col(prev, 1);
+  size_t prev_i = 0;
+  size_t kept = 0;
 
-    /* Find previous */
-    int have_prev = 0;
-    struct ts_prev_row *prev = NULL;
+  /* Listing /proc is cheap; only identities that are due are read */
+  for (size_t k = 0; k < count; ++k) {
+    double pid = (double)pids[k];
+    double metrics[TS_METRIC_COUNT];
+    long j = -1;
+    int fresh = 1;
 
-    /* Since both current and prev are sorted by PID (driver guarantees sort),
-     * we can scan linearly */
-    while (prev_i < ts_prev_count && ts_prev_rows[prev_i].pid < pid) {
+    while (prev_i < prev->count && prev_pid[prev_i] < pid) {
       prev_i++;
     }
-    if (prev_i < ts_prev_count && ts_prev_rows[prev_i].pid == pid &&
-        ts_prev_rows[prev_i].starttime == starttime) {
-      have_prev = 1;
-      prev = &ts_prev_rows[prev_i];
-    }
-
-    /* Compute Deltas */
-    const int counter_metrics[] = {TS_UTIME, TS_STIME, TS_VOL_CTX_SWITCHES,
-                                   TS_NONVOL_CTX_SWITCHES, TS_IO_READ_BYTES,
-                                   TS_IO_WRITE_BYTES, TS_MINFLT, TS_MAJFLT};
-
-    for (size_t c = 0; c < sizeof(counter_metrics) / sizeof(counter_metrics[0]); ++c) {
-      int idx = counter_metrics[c];
-      double curr = row_ptr[idx];
-      double delta = 0;
-
-      if (curr < 0) {
-        delta = -1;
-      } else if (!have_prev || !prev || prev->metrics[idx] < 0) {
-        delta = 0;
-      } else {
-        delta = curr - prev->metrics[idx];
-        if (delta < 0) delta = 0;
+    if (prev_i < prev->count && prev_pid[prev_i] == pid) {
+      j = (long)prev_i;
+    }
+
+    if (j >= 0 && ts_frame_col(prev, TS_ADAPT_WAIT)[j] > 1) {
+      /* Not due: carry forward (a reused pid is caught at the next read) */
+      fresh = 0;
+    } else {
+      if (!ts_driver_read_pid((pid_t)pids[k], metrics)) continue;
+      if (j >= 0 && prev_start[j] != metrics[TS_STARTTIME]) j = -1;
+    }
+
+    double *row_ptr = (row < max_rows) ? out + row * max_cols : NULL;
+    double *stale = (row < max_rows && stale_out) ? &stale_out[row] : NULL;
+    double *span = (row < max_rows && span_out) ? &span_out[row] : NULL;
+    int active = ts_adapt_emit(kept, j, metrics, fresh, now, row_ptr, stale,
+                               span);
+
+    ts_frame_col(curr, 0)[kept] = pid;
+    ts_frame_col(curr, 1)[kept] = ts_frame_col(curr, 5 + TS_STARTTIME)[kept];
+    if (fresh) {
+      /* Activity promotes to every frame; idle reads back off exponentially.
+       * New identities start in the fast tier. */
+      double period = (j >= 0) ? ts_frame_col(prev, TS_ADAPT_PERIOD)[j] : 1;
+      if (active || j < 0) {
+        period = 1;
+      } else if (period < TS_ADAPT_MAX_PERIOD) {
+        period *= 2;
       }
-      row_ptr[idx] = delta;
+      ts_frame_col(curr, TS_ADAPT_PERIOD)[kept] = period;
+      ts_frame_col(curr, TS_ADAPT_WAIT)[kept] =
+          ts_adapt_wait(pid, metrics[TS_STARTTIME], period);
+      ts_frame_col(curr, TS_ADAPT_READ_AT)[kept] = now;
+    } else {
+      ts_frame_col(curr, TS_ADAPT_PERIOD)[kept] =
+          ts_frame_col(prev, TS_ADAPT_PERIOD)[j];
+      ts_frame_col(curr, TS_ADAPT_WAIT)[kept] =
+          ts_frame_col(prev, TS_ADAPT_WAIT)[j] - 1;
+      ts_frame_col(curr, TS_ADAPT_READ_AT)[kept] =
+          ts_frame_col(prev, TS_ADAPT_READ_AT)[j];
+    }
+    kept++;
+
+    if (row < max_rows) {
+      pid_out[row] = pid;
+      row++;
+    }
+  }
+
+  struct ts_frame_cols tmp = ts_adapt_prev;
+  ts_adapt_prev = ts_adapt_curr;
+  ts_adapt_curr = tmp;
+  ts_adapt_prev.count = kept;
+  return kept;
+}
+
+int ts_is_counter_metric(size_t m) {
+  for (size_t c = 0; c < TS_COUNTER_COUNT; ++c) {
+    if ((size_t)ts_counter_metrics[c] == m) return 1;
+  }
+  return 0;
+}
+
+static int ts_ensure_coo_capacity(size_t rows) {
+  if (rows <= ts_coo_cap) {
+    return 1;
+  }
+  double *cols = realloc(ts_coo_cols, rows * TS_METRIC_COUNT * sizeof(*cols));
+  if (!cols) {
+    return 0;
+  }
+  ts_coo_cols = cols;
+  double *pids = realloc(ts_coo_pids, rows * sizeof(*pids));
+  if (!pids) {
+    return 0;
+  }
+  ts_coo_pids = pids;
+  ts_coo_cap = rows;
+  return 1;
+}
+
+/* Append one 3-wide record if it fits; always count it. */
+static void ts_emit3(double *out, size_t max, size_t *n, double a, double b,
+                     double c) {
+  if (out && *n < max) {
+    out[*n * 3] = a;
+    out[*n * 3 + 1] = b;
+    out[*n * 3 + 2] = c;
+  }
+  (*n)++;
+}
+
+size_t ts_snapshot_delta_coo(size_t max_rows, double *triples,
+                             size_t max_triples, double *events,
+                             size_t max_events, double *counts_out) {
+  size_t n_triples = 0;
+  size_t n_events = 0;
+
+  if (counts_out) {
+    counts_out[0] = counts_out[1] = counts_out[2] = 0;
+  }
+  if (max_rows == 0 || !ts_ensure_coo_capacity(max_rows)) return 0;
+
+  struct ts_layout layout = ts_metric_major(ts_coo_cap);
+  size_t count = ts_driver_capture_absolute(ts_coo_cols, max_rows, &layout,
+                                            ts_coo_pids, NULL);
+  size_t rows = (count < max_rows) ? count : max_rows;
+
+  if (!ts_delta_apply(&ts_coo, ts_coo_cols, rows, &layout, ts_coo_pids)) {
+    return 0;
+  }
+
+  /* After the swap, ts_coo.curr still holds the previous absolute frame */
+  const struct ts_frame_cols *old = &ts_coo.curr;
+  const long *match = ts_coo.match;
+  const double *start_col = ts_coo_cols + (TS_STARTTIME * ts_coo_cap);
+
+  /* Exits: previous rows that no current row matched (match is increasing) */
+  const double *old_pid = ts_frame_col(old, 0);
+  const double *old_start = ts_frame_col(old, 1);
+  size_t i = 0;
+  for (size_t j = 0; j < old->count; ++j) {
+    while (i < rows && match[i] < (long)j) {
+      i++;
+    }
+    if (i >= rows || match[i] != (long)j) {
+      ts_emit3(events, max_events, &n_events, old_pid[j], old_start[j], -1);
+    }
+  }
+
+  /* Births */
+  for (i = 0; i < rows; ++i) {
+    if (match[i] < 0) {
+      ts_emit3(events, max_events, &n_events, ts_coo_pids[i], start_col[i], 1);
     }
+  }
 
-    processed_count++;
+  /* Changes: values that differ from what ApplyCoo carries forward. Gauges
+   * carry their previous sample (0 for births); counters reset to 0 unless
+   * the previous value was the -1 sentinel, so an unreadable counter is
+   * emitted only when it becomes or stops being -1. starttime rides on the
+   * birth event. */
+  for (size_t m = 0; m < TS_METRIC_COUNT; ++m) {
+    const double *col = ts_coo_cols + (m * ts_coo_cap);
+    const double *old_col = ts_frame_col(old, 2 + m);
+    int counter = ts_is_counter_metric(m);
+    if (m == TS_STARTTIME) continue;
+    for (i = 0; i < rows; ++i) {
+      double before = 0;
+      if (match[i] >= 0) {
+        before = old_col[match[i]];
+        if (counter) before = (before < 0) ? -1 : 0;
+      }
+      if (col[i] != before) {
+        ts_emit3(triples, max_triples, &n_triples, ts_coo_pids[i], (double)m,
+                 col[i]);
+      }
+    }
   }
 
-  /* Swap buffers */
-  struct ts_prev_row *tmp = ts_prev_rows;
-  ts_prev_rows = ts_curr_rows;
-  ts_curr_rows = tmp;
-  ts_prev_count = processed_count;
+  /* A truncated frame would lose its changes for good: keep the previous
+   * frame as the base so the caller can retry with larger buffers. */
+  if (n_triples > max_triples || n_events > max_events) {
+    struct ts_frame_cols tmp = ts_coo.prev;
+    ts_coo.prev = ts_coo.curr;
+    ts_coo.curr = tmp;
+    ts_coo_rows = 0;
+  } else {
+    ts_coo_rows = rows;
+  }
 
+  if (counts_out) {
+    counts_out[0] = (double)n_triples;
+    counts_out[1] = (double)n_events;
+    counts_out[2] = (double)rows;
+  }
   return count;
 }
 
+size_t ts_coo_dense(double *out, size_t max_rows, size_t max_cols,
+                    double *pid_out) {
+  size_t rows = (ts_coo_rows < max_rows) ? ts_coo_rows : max_rows;
 
-void ts_free_thread_resources(size_t ignored) {
+  if (!out || max_cols < TS_METRIC_COUNT) return 0;
+  for (size_t i = 0; i < rows; ++i) {
+    for (size_t m = 0; m < TS_METRIC_COUNT; ++m) {
+      out[i * max_cols + m] = ts_coo_cols[m * ts_coo_cap + i];
+    }
+    if (pid_out) pid_out[i] = ts_coo_pids[i];
+  }
+  return ts_coo_rows;
+}
+
+static size_t ts_elem_size(double type) {
+  switch ((int)type) {
+    case TS_ELEM_F32: return sizeof(float);
+    case TS_ELEM_I32: return sizeof(int32_t);
+    default: return sizeof(double);
+  }
+}
+
+static int32_t ts_encode_i32(double v, double scale) {
+  if (v >= 0 && scale > 0) {
+    v = v / scale + 0.5;
+  }
+  if (v >= 2147483647.0) {
+    ts_typed_clamped++;
+    return INT32_MAX;
+  }
+  if (v <= -2147483648.0) {
+    ts_typed_clamped++;
+    return INT32_MIN;
+  }
+  return (int32_t)v;
+}
+
+/* Append one value to a packed row as type; returns the advanced cursor. */
+static unsigned char *ts_encode_value(unsigned char *out, double v,
+                                      double type, double scale) {
+  switch ((int)type) {
+    case TS_ELEM_F32: {
+      float f = (float)v;
+      memcpy(out, &f, sizeof(f));
+      return out + sizeof(f);
+    }
+    case TS_ELEM_I32: {
+      int32_t n = ts_encode_i32(v, scale);
+      memcpy(out, &n, sizeof(n));
+      return out + sizeof(n);
+    }
+    default:
+      memcpy(out, &v, sizeof(v));
+      return out + sizeof(v);
+  }
+}
+
+/* put_row for ts_snapshot_typed: encode the driver's row in place. */
+static void ts_typed_put_row(const struct ts_layout *layout, size_t row,
+                             double id, const double *metrics) {
+  const struct ts_typed_sink *sink = layout->ctx;
+  unsigned char *out = sink->out + (row * sink->row_bytes);
+  for (size_t j = 0; j < sink->max_cols; ++j) {
+    double v = (j < TS_METRIC_COUNT) ? metrics[j] : 0;
+    out = ts_encode_value(out, v, sink->types[j],
+                          sink->scales ? sink->scales[j] : 1);
+  }
+  if (sink->pid_out) sink->pid_out[row] = (int32_t)id;
+}
+
+int ts_proc_events_start(size_t capacity) {
+  return ts_driver_events_start(capacity);
+}
+
+void ts_proc_events_stop(size_t ignored) {
   (void)ignored;
-  ts_driver_free_thread_resources();
-  
-  if (ts_prev_rows) {
-    free(ts_prev_rows);
-    ts_prev_rows = NULL;
+  ts_driver_events_stop();
+}
+
+size_t ts_proc_events_drain(double *out, size_t max_rows, size_t max_cols,
+                            double *pid_out) {
+  if (max_cols < TS_METRIC_COUNT) return 0;
+  struct ts_layout layout = ts_row_major(max_cols);
+  return ts_driver_events_drain(out, max_rows, &layout, pid_out);
+}
+
+size_t ts_proc_events_stats(double *out, size_t n) {
+  return ts_driver_events_stats(out, n);
+}
+
+/*
+ * Compact schema. Gauges and ids are int32 (rss in pages), vsize float32,
+ * starttime float64. Absolute counters stay float64: cumulative faults,
+ * context switches and io outgrow int32. Delta counters are int32, CPU
+ * time in ticks (1 us on macOS, which reports nanoseconds) and io in the
+ * 512-byte units the kernel accounts read_bytes/write_bytes in.
+ */
+static size_t ts_fill_schema(double *types_out, double *scales_out, size_t n,
+                             int delta) {
+  long page = sysconf(_SC_PAGESIZE);
+#if defined(__APPLE__)
+  double tick_ns = 1000;
+#else
+  long hz = sysconf(_SC_CLK_TCK);
+  double tick_ns = 1e9 / (double)(hz > 0 ? hz : 100);
+#endif
+  double page_bytes = (double)(page > 0 ? page : 4096);
+
+  if (!types_out || !scales_out) return 0;
+
+  for (size_t j = 0; j < n; ++j) {
+    double type = TS_ELEM_F64;
+    double scale = 1;
+    if (j < TS_METRIC_COUNT && ts_is_counter_metric(j)) {
+      if (delta) {
+        type = TS_ELEM_I32;
+        if (j == TS_UTIME || j == TS_STIME) scale = tick_ns;
+        if (j == TS_IO_READ_BYTES || j == TS_IO_WRITE_BYTES) scale = 512;
+      }
+      types_out[j] = type;
+      scales_out[j] = scale;
+      continue;
+    }
+    switch ((int)j) {
+      case TS_RSS:
+        type = TS_ELEM_I32;
+        scale = page_bytes;
+        break;
+      case TS_VSIZE:
+        type = TS_ELEM_F32;
+        break;
+      case TS_STARTTIME:
+        type = TS_ELEM_F64;
+        break;
+      default:
+        if (j < TS_METRIC_COUNT) type = TS_ELEM_I32;
+        break;
+    }
+    types_out[j] = type;
+    scales_out[j] = scale;
+  }
+  return n;
+}
+
+size_t ts_get_metric_schema(double *types_out, double *scales_out, size_t n) {
+  return ts_fill_schema(types_out, scales_out, n, 0);
+}
+
+size_t ts_get_delta_schema(double *types_out, double *scales_out, size_t n) {
+  return ts_fill_schema(types_out, scales_out, n, 1);
+}
+
+size_t ts_typed_saturated(size_t ignored) {
+  (void)ignored;
+  return ts_typed_clamped;
+}
+
+size_t ts_schema_row_bytes(const double *types, size_t max_cols) {
+  size_t bytes = 0;
+  if (!types) return 0;
+  for (size_t j = 0; j < max_cols; ++j) {
+    bytes += ts_elem_size(types[j]);
+  }
+  return bytes;
+}
+
+size_t ts_snapshot_typed(void *out, size_t max_rows, size_t max_cols,
+                         const double *types, const double *scales,
+                         int32_t *pid_out) {
+  struct ts_typed_sink sink;
+  if (!out || !types || max_cols < TS_METRIC_COUNT) return 0;
+
+  sink.out = out;
+  sink.row_bytes = ts_schema_row_bytes(types, max_cols);
+  sink.max_cols = max_cols;
+  sink.types = types;
+  sink.scales = scales;
+  sink.pid_out = pid_out;
+
+  struct ts_layout layout = ts_row_major(max_cols);
+  layout.put_row = ts_typed_put_row;
+  layout.ctx = &sink;
+  ts_typed_clamped = 0;
+  return ts_driver_capture_absolute(NULL, max_rows, &layout, NULL, NULL);
+}
+
+/*
+ * The driver writes absolute values straight into the delta state's current
+ * frame (which is kept for the next call anyway), and each row is encoded
+ * from there with its counters differenced against the previous frame.
+ */
+size_t ts_snapshot_delta_typed(void *out, size_t max_rows, size_t max_cols,
+                               const double *types, const double *scales,
+                               int32_t *pid_out) {
+  struct ts_delta_state *st = &ts_delta;
+  if (!pid_out) {
+    st->prev.count = 0;
+    return 0;
+  }
+  if (!out || !types || max_cols < TS_METRIC_COUNT) return 0;
+  if (!ts_ensure_frame_capacity(&st->curr, max_rows) ||
+      !ts_ensure_delta_scratch(st, max_rows)) {
+    return 0;
   }
-  ts_prev_cap = 0;
-  ts_prev_count = 0;
 
-  if (ts_curr_rows) {
-    free(ts_curr_rows);
-    ts_curr_rows = NULL;
+  struct ts_layout layout = ts_metric_major(st->curr.cap);
+  size_t count = ts_driver_capture_absolute(ts_frame_col(&st->curr, 2),
+                                            max_rows, &layout,
+                                            ts_frame_col(&st->curr, 0), NULL);
+  size_t rows = (count < max_rows) ? count : max_rows;
+  if (count == 0) return 0;
+
+  const double *prev_pid = ts_frame_col(&st->prev, 0);
+  const double *prev_start = ts_frame_col(&st->prev, 1);
+  const double *curr_pid = ts_frame_col(&st->curr, 0);
+  double *curr_start = ts_frame_col(&st->curr, 1);
+  size_t prev_i = 0;
+  unsigned char *dst = out;
+
+  ts_typed_clamped = 0;
+  for (size_t i = 0; i < rows; ++i) {
+    double starttime = ts_frame_col(&st->curr, 2 + TS_STARTTIME)[i];
+    curr_start[i] = starttime;
+    while (prev_i < st->prev.count && prev_pid[prev_i] < curr_pid[i]) {
+      prev_i++;
+    }
+    long j = (prev_i < st->prev.count && prev_pid[prev_i] == curr_pid[i] &&
+              prev_start[prev_i] == starttime)
+                 ? (long)prev_i
+                 : -1;
+
+    for (size_t c = 0; c < max_cols; ++c) {
+      double v = 0;
+      if (c < TS_METRIC_COUNT) {
+        v = ts_frame_col(&st->curr, 2 + c)[i];
+        if (ts_is_counter_metric(c) && v >= 0) {
+          double prev = (j >= 0) ? ts_frame_col(&st->prev, 2 + c)[j] : -1;
+          v = (prev < 0 || v < prev) ? 0 : v - prev;
+        }
+      }
+      dst = ts_encode_value(dst, v, types[c], scales ? scales[c] : 1);
+    }
+    pid_out[i] = (int32_t)curr_pid[i];
   }
-  ts_curr_cap = 0;
+
+  struct ts_frame_cols tmp = st->prev;
+  st->prev = st->curr;
+  st->curr = tmp;
+  st->prev.count = rows;
+  return count;
+}
+
+void ts_free_thread_resources(size_t ignored) {
+  (void)ignored;
+  ts_driver_free_thread_resources();
+  ts_delta_state_free(&ts_delta);
+  ts_delta_state_free(&ts_coo);
+  ts_delta_state_free(&ts_task_delta);
+  free(ts_adapt_prev.data);
+  free(ts_adapt_curr.data);
+  memset(&ts_adapt_prev, 0, sizeof(ts_adapt_prev));
+  memset(&ts_adapt_curr, 0, sizeof(ts_adapt_curr));
+  free(ts_coo_cols);
+  ts_coo_cols = NULL;
+  free(ts_coo_pids);
+  ts_coo_pids = NULL;
+  ts_coo_cap = 0;
+  ts_coo_rows = 0;
 }
 
 size_t ts_core_count(size_t ignored) {
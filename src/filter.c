@@ -0,0 +1,247 @@
+#define _POSIX_C_SOURCE 200809L
+#include "driver.h"
+#include <fnmatch.h>
+#include <stdlib.h>
+#include <string.h>
+
+/* Compiled predicate filter: numeric sets are sorted once and probed with
+ * bsearch; string predicates are glob patterns with a prefix fast path. */
+
+struct ts_id_set {
+  long long *v;
+  size_t count;
+  size_t cap;
+  int sorted;
+};
+
+enum ts_pattern_kind { TS_PAT_EXACT, TS_PAT_PREFIX, TS_PAT_PATH, TS_PAT_GLOB };
+
+struct ts_pattern {
+  char *text;
+  size_t len; /* bytes compared for TS_PAT_PREFIX and TS_PAT_PATH */
+  enum ts_pattern_kind kind;
+};
+
+struct ts_pattern_list {
+  struct ts_pattern *v;
+  size_t count;
+  size_t cap;
+};
+
+struct ts_compiled_filter {
+  struct ts_id_set pids;
+  struct ts_id_set uids;
+  struct ts_id_set ppids;
+  struct ts_pattern_list comm;
+  struct ts_pattern_list cgroup;
+  struct ts_pattern_list cmdline;
+};
+
+static int ts_cmp_ids(const void *a, const void *b) {
+  long long ia = *(const long long *)a;
+  long long ib = *(const long long *)b;
+  return (ia < ib) ? -1 : (ia > ib);
+}
+
+static int ts_id_set_add(struct ts_id_set *set, const double *ids, size_t n) {
+  if (!ids) return 0;
+  if (set->count + n > set->cap) {
+    size_t new_cap = set->cap ? set->cap : 64;
+    while (new_cap < set->count + n) {
+      new_cap *= 2;
+    }
+    long long *tmp = realloc(set->v, new_cap * sizeof(*tmp));
+    if (!tmp) return 0;
+    set->v = tmp;
+    set->cap = new_cap;
+  }
+  for (size_t i = 0; i < n; ++i) {
+    set->v[set->count++] = (long long)ids[i];
+  }
+  set->sorted = 0;
+  return 1;
+}
+
+static void ts_id_set_compile(struct ts_id_set *set) {
+  size_t unique = 0;
+  if (set->sorted) return;
+  if (set->count > 1) qsort(set->v, set->count, sizeof(*set->v), ts_cmp_ids);
+  for (size_t i = 0; i < set->count; ++i) {
+    if (unique == 0 || set->v[unique - 1] != set->v[i]) {
+      set->v[unique++] = set->v[i];
+    }
+  }
+  set->count = unique;
+  set->sorted = 1;
+}
+
+/* Empty sets accept everything. */
+static int ts_id_set_match(const struct ts_id_set *set, long long id) {
+  if (set->count == 0) return 1;
+  if (set->sorted) {
+    return bsearch(&id, set->v, set->count, sizeof(*set->v), ts_cmp_ids) != NULL;
+  }
+  for (size_t i = 0; i < set->count; ++i) {
+    if (set->v[i] == id) return 1;
+  }
+  return 0;
+}
+
+/* Globs of the form "literal" or "literal*" are matched without fnmatch.
+ * Path prefixes match whole components only. */
+static int ts_pattern_add(struct ts_pattern_list *list, const char *text,
+                          int path_prefix) {
+  if (!text) return 0;
+  if (list->count == list->cap) {
+    size_t new_cap = list->cap ? list->cap * 2 : 8;
+    struct ts_pattern *tmp = realloc(list->v, new_cap * sizeof(*tmp));
+    if (!tmp) return 0;
+    list->v = tmp;
+    list->cap = new_cap;
+  }
+  size_t len = strlen(text);
+  char *copy = malloc(len + 1);
+  if (!copy) return 0;
+  memcpy(copy, text, len + 1);
+
+  /* "/a/" names the same subtree as "/a" */
+  while (path_prefix && len > 1 && copy[len - 1] == '/') copy[--len] = '\0';
+
+  struct ts_pattern *p = &list->v[list->count++];
+  size_t literal = strcspn(copy, "*?[\\");
+  p->text = copy;
+  p->len = len;
+  if (path_prefix) {
+    p->kind = TS_PAT_PATH;
+  } else if (literal == len) {
+    p->kind = TS_PAT_EXACT;
+  } else if (literal + 1 == len && copy[literal] == '*') {
+    p->kind = TS_PAT_PREFIX;
+    p->len = literal;
+  } else {
+    p->kind = TS_PAT_GLOB;
+  }
+  return 1;
+}
+
+static int ts_pattern_hit(const struct ts_pattern *p, const char *text) {
+  switch (p->kind) {
+    case TS_PAT_EXACT: return strcmp(p->text, text) == 0;
+    case TS_PAT_PREFIX: return strncmp(p->text, text, p->len) == 0;
+    case TS_PAT_PATH:
+      /* "/sys" matches "/sys" and "/sys/x", not "/system.slice" */
+      return strncmp(p->text, text, p->len) == 0 &&
+             (p->len == 0 || p->text[p->len - 1] == '/' ||
+              text[p->len] == '\0' || text[p->len] == '/');
+    default: return fnmatch(p->text, text, 0) == 0;
+  }
+}
+
+/* Empty lists accept everything. */
+static int ts_pattern_match(const struct ts_pattern_list *list,
+                            const char *text) {
+  if (list->count == 0) return 1;
+  if (!text) return 0;
+  for (size_t i = 0; i < list->count; ++i) {
+    if (ts_pattern_hit(&list->v[i], text)) return 1;
+  }
+  return 0;
+}
+
+static void ts_pattern_free(struct ts_pattern_list *list) {
+  for (size_t i = 0; i < list->count; ++i) {
+    free(list->v[i].text);
+  }
+  free(list->v);
+}
+
+struct ts_compiled_filter *ts_filter_create(size_t ignored) {
+  (void)ignored;
+  return calloc(1, sizeof(struct ts_compiled_filter));
+}
+
+void ts_filter_destroy(struct ts_compiled_filter *f) {
+  if (!f) return;
+  free(f->pids.v);
+  free(f->uids.v);
+  free(f->ppids.v);
+  ts_pattern_free(&f->comm);
+  ts_pattern_free(&f->cgroup);
+  ts_pattern_free(&f->cmdline);
+  free(f);
+}
+
+int ts_filter_add_pids(struct ts_compiled_filter *f, const double *pids,
+                       size_t n) {
+  return f ? ts_id_set_add(&f->pids, pids, n) : 0;
+}
+
+int ts_filter_add_uids(struct ts_compiled_filter *f, const double *uids,
+                       size_t n) {
+  return f ? ts_id_set_add(&f->uids, uids, n) : 0;
+}
+
+int ts_filter_add_ppids(struct ts_compiled_filter *f, const double *ppids,
+                        size_t n) {
+  return f ? ts_id_set_add(&f->ppids, ppids, n) : 0;
+}
+
+int ts_filter_add_comm(struct ts_compiled_filter *f, const char *pattern) {
+  return f ? ts_pattern_add(&f->comm, pattern, 0) : 0;
+}
+
+int ts_filter_add_cgroup(struct ts_compiled_filter *f, const char *prefix) {
+  return f ? ts_pattern_add(&f->cgroup, prefix, 1) : 0;
+}
+
+int ts_filter_add_cmdline(struct ts_compiled_filter *f, const char *pattern) {
+  return f ? ts_pattern_add(&f->cmdline, pattern, 0) : 0;
+}
+
+int ts_filter_compile(struct ts_compiled_filter *f) {
+  if (!f) return 0;
+  ts_id_set_compile(&f->pids);
+  ts_id_set_compile(&f->uids);
+  ts_id_set_compile(&f->ppids);
+  return 1;
+}
+
+int ts_filter_match_pid(const struct ts_compiled_filter *f, pid_t pid) {
+  return !f || ts_id_set_match(&f->pids, pid);
+}
+
+int ts_filter_match_stat(const struct ts_compiled_filter *f, const char *comm,
+                         long long ppid) {
+  if (!f) return 1;
+  return ts_id_set_match(&f->ppids, ppid) && ts_pattern_match(&f->comm, comm);
+}
+
+int ts_filter_match_uid(const struct ts_compiled_filter *f, long long uid) {
+  return !f || ts_id_set_match(&f->uids, uid);
+}
+
+int ts_filter_lists_pids(const struct ts_compiled_filter *f) {
+  return f && f->pids.count > 0;
+}
+
+int ts_filter_needs_uid(const struct ts_compiled_filter *f) {
+  return f && f->uids.count > 0;
+}
+
+int ts_filter_needs_cgroup(const struct ts_compiled_filter *f) {
+  return f && f->cgroup.count > 0;
+}
+
+int ts_filter_match_cgroup(const struct ts_compiled_filter *f,
+                           const char *path) {
+  return !f || ts_pattern_match(&f->cgroup, path);
+}
+
+int ts_filter_needs_cmdline(const struct ts_compiled_filter *f) {
+  return f && f->cmdline.count > 0;
+}
+
+int ts_filter_match_cmdline(const struct ts_compiled_filter *f,
+                            const char *cmdline) {
+  return !f || ts_pattern_match(&f->cmdline, cmdline);
+}
@@ -0,0 +1,112 @@
+#define _POSIX_C_SOURCE 200809L
+#include "driver.h"
+
+#include <stdlib.h>
+#include <time.h>
+
+/* Degradation ladder: levels 1-3 double the interval, level 4 skips io,
+ * levels 5-7 halve max_rows and stride the scan down to it. */
+#define TS_GOV_WIDEN_LEVELS 3
+#define TS_GOV_SKIP_IO_LEVEL 4
+#define TS_GOV_MAX_LEVEL 7
+/* Steps under half the budget before one level is undone */
+#define TS_GOV_CALM_STEPS 3
+
+struct ts_governor {
+  double budget;
+  double interval;
+  size_t rows;
+  int level;
+  int calm;
+  int primed;
+  double last_wall;
+  double last_cpu;
+  double cpu;
+};
+
+static double ts_gov_clock(clockid_t id) {
+  struct timespec ts;
+  if (clock_gettime(id, &ts) != 0) return 0.0;
+  return (double)ts.tv_sec + (double)ts.tv_nsec / 1e9;
+}
+
+struct ts_governor *ts_governor_create(double budget, double interval,
+                                       size_t rows) {
+  if (!(budget > 0) || !(interval > 0) || rows == 0) return NULL;
+
+  struct ts_governor *g = calloc(1, sizeof(*g));
+  if (!g) return NULL;
+  g->budget = budget;
+  g->interval = interval;
+  g->rows = rows;
+  return g;
+}
+
+/* The plan's read flags outlive the governor unless cleared here. */
+void ts_governor_destroy(struct ts_governor *g) {
+  if (!g) return;
+  ts_driver_set_read_flags(0);
+  free(g);
+}
+
+size_t ts_governor_step(struct ts_governor *g, double *plan_out, size_t n) {
+  double plan[TS_PLAN_FIELD_COUNT];
+  unsigned flags = 0;
+  int shrink = 0;
+
+  if (!g) return 0;
+
+  /* Process CPU time covers every thread, including exporter/listener */
+  double wall = ts_gov_clock(CLOCK_MONOTONIC);
+  double cpu = ts_gov_clock(CLOCK_PROCESS_CPUTIME_ID);
+
+  if (g->primed && wall > g->last_wall) {
+    g->cpu = (cpu - g->last_cpu) / (wall - g->last_wall);
+    if (g->cpu > g->budget) {
+      if (g->level < TS_GOV_MAX_LEVEL) g->level++;
+      g->calm = 0;
+    } else if (g->cpu < 0.5 * g->budget) {
+      if (++g->calm >= TS_GOV_CALM_STEPS && g->level > 0) {
+        g->level--;
+        g->calm = 0;
+      }
+    } else {
+      g->calm = 0;
+    }
+  }
+  g->primed = 1;
+  g->last_wall = wall;
+  g->last_cpu = cpu;
+
+  int widen = g->level < TS_GOV_WIDEN_LEVELS ? g->level : TS_GOV_WIDEN_LEVELS;
+  if (g->level >= TS_GOV_SKIP_IO_LEVEL) flags |= TS_READ_SKIP_IO;
+  if (g->level > TS_GOV_SKIP_IO_LEVEL) {
+    flags |= TS_READ_STRIDE;
+    shrink = g->level - TS_GOV_SKIP_IO_LEVEL;
+  }
+  size_t rows = g->rows >> shrink;
+
+  plan[TS_PLAN_INTERVAL] = g->interval * (double)(1 << widen);
+  plan[TS_PLAN_ROWS] = (double)(rows ? rows : 1);
+  plan[TS_PLAN_FLAGS] = (double)flags;
+  plan[TS_PLAN_LEVEL] = (double)g->level;
+  plan[TS_PLAN_CPU] = g->cpu;
+  plan[TS_PLAN_BUDGET] = g->budget;
+  /* The capture since the last step ran under the flags that step set */
+  plan[TS_PLAN_STRIDE] = (double)ts_driver_read_stride();
+  ts_driver_set_read_flags(flags);
+
+  if (!plan_out) return 0;
+  if (n > TS_PLAN_FIELD_COUNT) n = TS_PLAN_FIELD_COUNT;
+  for (size_t i = 0; i < n; ++i) {
+    plan_out[i] = plan[i];
+  }
+  return n;
+}
+
+int ts_sampler_set_idle(size_t ignored) {
+  (void)ignored;
+  return ts_driver_set_sched_idle();
+}
+
+int ts_sampler_set_affinity(size_t cpu) { return ts_driver_set_affinity(cpu); }
@@ -0,0 +1,957 @@
+#define _GNU_SOURCE
+#include "driver.h"
+
+#include <dirent.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <math.h>
+#include <poll.h>
+#include <pthread.h>
+#include <sched.h>
+#include <signal.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/socket.h>
+#include <sys/time.h>
+#include <time.h>
+#include <unistd.h>
+
+#include <linux/acct.h>
+#include <linux/cn_proc.h>
+#include <linux/connector.h>
+#include <linux/genetlink.h>
+#include <linux/netlink.h>
+#include <linux/taskstats.h>
+
+#define TS_EV_RCVBUF (1 << 20)
+
+/* Taskstats v12 added ac_tgid, ac_tgetime and the AGROUP flag. */
+#define TS_EV_TASKSTATS_MIN_VERSION 12
+
+/* Groups that have lost threads but are still running (listener only). */
+#define TS_EV_GROUPS 1024
+
+/*
+ * One listener per process. ts_ev_ctl serializes start/stop; ts_ev_lock
+ * guards the queue and counters shared with the listener thread.
+ */
+static pthread_mutex_t ts_ev_ctl = PTHREAD_MUTEX_INITIALIZER;
+static pthread_mutex_t ts_ev_lock = PTHREAD_MUTEX_INITIALIZER;
+static pthread_t ts_ev_thread;
+static int ts_ev_running = 0;
+static int ts_ev_sock = -1;
+static int ts_ev_stats_sock = -1; /* taskstats; -1 falls back to /proc */
+static uint16_t ts_ev_stats_family = 0;
+static int ts_ev_wake[2] = {-1, -1};
+static double ts_ev_tick_ns = 0.0;
+
+/* Ring of exit rows: TS_METRIC_COUNT doubles per slot */
+static double *ts_ev_rows = NULL;
+static double *ts_ev_pids = NULL;
+static size_t ts_ev_cap = 0;
+static size_t ts_ev_head = 0;
+static size_t ts_ev_len = 0;
+static unsigned long long ts_ev_counts[TS_EV_STAT_COUNT];
+
+/*
+ * Live processes by tgid (taskstats mode, listener only): starttime as
+ * /proc reports it, read when the fork is seen or when the listener starts,
+ * so exit rows carry the same PID×StartTime key as snapshots. Open
+ * addressing with linear probing; tgid 0 marks a free slot.
+ */
+struct ts_ev_proc {
+  pid_t tgid;
+  int group; /* slot in ts_ev_groups, -1 until a thread exits */
+  double start_ns;
+};
+static struct ts_ev_proc *ts_ev_procs = NULL;
+static size_t ts_ev_procs_cap = 0; /* power of two */
+static size_t ts_ev_procs_len = 0;
+
+/* Counter sums of the threads a still-running group has already lost. */
+struct ts_ev_group {
+  pid_t tgid; /* 0 when the slot is free */
+  double sums[TS_METRIC_COUNT];
+};
+static struct ts_ev_group ts_ev_groups[TS_EV_GROUPS];
+static int ts_ev_group_free[TS_EV_GROUPS];
+static size_t ts_ev_group_nfree = 0;
+static size_t ts_ev_group_victim = 0;
+static size_t ts_ev_reclaim_wait = 0; /* allocations before the next scan */
+
+/* A socket overran: exits may have been lost, so sweep dead entries */
+static int ts_ev_sweep_due = 0;
+static double ts_ev_swept_at = 0.0;
+
+/* Last group captured by the /proc fallback, to drop a repeated exit */
+static pid_t ts_ev_last_tgid = 0;
+static double ts_ev_last_start = -1.0;
+
+static void ts_ev_count(int stat) {
+  pthread_mutex_lock(&ts_ev_lock);
+  ts_ev_counts[stat]++;
+  pthread_mutex_unlock(&ts_ev_lock);
+}
+
+/* Queue the final row of an exited process; metrics NULL counts it missed. */
+static void ts_ev_queue(pid_t pid, const double *metrics) {
+  pthread_mutex_lock(&ts_ev_lock);
+  ts_ev_counts[TS_EV_EXITS]++;
+  if (!metrics) {
+    ts_ev_counts[TS_EV_MISSED]++;
+  } else if (ts_ev_len == ts_ev_cap) {
+    ts_ev_counts[TS_EV_DROPPED]++;
+  } else {
+    size_t slot = (ts_ev_head + ts_ev_len) % ts_ev_cap;
+    memcpy(ts_ev_rows + slot * TS_METRIC_COUNT, metrics,
+           TS_METRIC_COUNT * sizeof(*metrics));
+    ts_ev_pids[slot] = (double)pid;
+    ts_ev_len++;
+    ts_ev_counts[TS_EV_CAPTURED]++;
+  }
+  pthread_mutex_unlock(&ts_ev_lock);
+}
+
+/* Open a connector socket joined to the proc events group, or -1. */
+static int ts_ev_open(void) {
+  struct sockaddr_nl addr;
+  union {
+    struct nlmsghdr hdr;
+    char bytes[NLMSG_SPACE(sizeof(struct cn_msg) +
+                           sizeof(enum proc_cn_mcast_op))];
+  } req;
+  struct cn_msg *cn = NULL;
+  enum proc_cn_mcast_op op = PROC_CN_MCAST_LISTEN;
+  int rcvbuf = TS_EV_RCVBUF;
+  int sock = -1;
+
+  sock = socket(AF_NETLINK, SOCK_DGRAM | SOCK_CLOEXEC, NETLINK_CONNECTOR);
+  if (sock < 0) return -1;
+  /* Best effort: a larger buffer absorbs fork storms between wakeups */
+  setsockopt(sock, SOL_SOCKET, SO_RCVBUF, &rcvbuf, sizeof(rcvbuf));
+
+  memset(&addr, 0, sizeof(addr));
+  addr.nl_family = AF_NETLINK;
+  addr.nl_groups = CN_IDX_PROC;
+  if (bind(sock, (struct sockaddr *)&addr, sizeof(addr)) < 0) {
+    close(sock);
+    return -1;
+  }
+
+  memset(&req, 0, sizeof(req));
+  cn = NLMSG_DATA(&req.hdr);
+  req.hdr.nlmsg_len = NLMSG_LENGTH(sizeof(*cn) + sizeof(op));
+  req.hdr.nlmsg_type = NLMSG_DONE;
+  cn->id.idx = CN_IDX_PROC;
+  cn->id.val = CN_VAL_PROC;
+  cn->len = sizeof(op);
+  memcpy(cn->data, &op, sizeof(op));
+  if (send(sock, &req, req.hdr.nlmsg_len, 0) < 0) {
+    close(sock);
+    return -1;
+  }
+  return sock;
+}
+
+/* Find attribute 'type' among the len bytes at attrs, or NULL. */
+static const struct nlattr *ts_ev_attr(const void *attrs, size_t len,
+                                       int type) {
+  const char *p = attrs;
+  while (len >= NLA_HDRLEN) {
+    const struct nlattr *a = (const struct nlattr *)p;
+    size_t step = NLA_ALIGN(a->nla_len);
+    if (a->nla_len < NLA_HDRLEN || a->nla_len > len) return NULL;
+    if ((a->nla_type & NLA_TYPE_MASK) == type) return a;
+    if (step >= len) return NULL;
+    p += step;
+    len -= step;
+  }
+  return NULL;
+}
+
+static const void *ts_ev_attr_data(const struct nlattr *a) {
+  return (const char *)a + NLA_HDRLEN;
+}
+
+static size_t ts_ev_attr_len(const struct nlattr *a) {
+  return a->nla_len - NLA_HDRLEN;
+}
+
+/* Send one generic netlink request carrying a single attribute. Requests
+ * answered with data are sent without NLM_F_ACK so no stray ack is left. */
+static int ts_ev_genl_send(int sock, uint16_t family, uint8_t cmd,
+                           uint16_t attr, const void *data, size_t len,
+                           uint16_t flags) {
+  union {
+    struct nlmsghdr hdr;
+    char bytes[NLMSG_SPACE(GENL_HDRLEN + NLA_HDRLEN + 256)];
+  } req;
+  struct genlmsghdr *g = NULL;
+  struct nlattr *a = NULL;
+
+  if (len > 256) return 0;
+  memset(&req, 0, sizeof(req));
+  req.hdr.nlmsg_len = NLMSG_LENGTH(GENL_HDRLEN + NLA_HDRLEN + len);
+  req.hdr.nlmsg_type = family;
+  req.hdr.nlmsg_flags = NLM_F_REQUEST | flags;
+  g = NLMSG_DATA(&req.hdr);
+  g->cmd = cmd;
+  g->version = TASKSTATS_GENL_VERSION;
+  a = (struct nlattr *)((char *)g + GENL_HDRLEN);
+  a->nla_type = attr;
+  a->nla_len = (uint16_t)(NLA_HDRLEN + len);
+  memcpy((char *)a + NLA_HDRLEN, data, len);
+  return send(sock, &req, req.hdr.nlmsg_len, 0) >= 0;
+}
+
+/*
+ * Receive the reply to the last request into buf. Returns the first message
+ * of type 'type', or NULL on an ack or error. *ok is cleared on an error ack
+ * or a failed recv. Other messages are skipped.
+ */
+static const struct nlmsghdr *ts_ev_genl_reply(int sock, long *buf,
+                                               size_t size, uint16_t type,
+                                               int *ok) {
+  for (;;) {
+    int len = (int)recv(sock, buf, size, 0);
+    if (len < 0) {
+      if (errno == EINTR) continue;
+      *ok = 0;
+      return NULL;
+    }
+    for (struct nlmsghdr *h = (struct nlmsghdr *)buf; NLMSG_OK(h, len);
+         h = NLMSG_NEXT(h, len)) {
+      if (h->nlmsg_type == NLMSG_ERROR) {
+        const struct nlmsgerr *err = NLMSG_DATA(h);
+        *ok = err->error == 0;
+        return NULL;
+      }
+      if (h->nlmsg_type == type) return h;
+    }
+  }
+}
+
+/* Per-task stats of a TASKSTATS_CMD_NEW message, zero-extended; 1 if found. */
+static int ts_ev_task_stats(const struct nlmsghdr *h, struct taskstats *out) {
+  const struct genlmsghdr *g = NLMSG_DATA(h);
+  const struct nlattr *aggr = NULL;
+  const struct nlattr *stats = NULL;
+  size_t len = 0;
+
+  if (h->nlmsg_len < NLMSG_LENGTH(GENL_HDRLEN)) return 0;
+  if (g->cmd != TASKSTATS_CMD_NEW) return 0;
+  aggr = ts_ev_attr((const char *)g + GENL_HDRLEN,
+                    h->nlmsg_len - NLMSG_LENGTH(GENL_HDRLEN),
+                    TASKSTATS_TYPE_AGGR_PID);
+  if (aggr) {
+    stats = ts_ev_attr(ts_ev_attr_data(aggr), ts_ev_attr_len(aggr),
+                       TASKSTATS_TYPE_STATS);
+  }
+  if (!stats) return 0;
+
+  len = ts_ev_attr_len(stats);
+  if (len > sizeof(*out)) len = sizeof(*out);
+  memset(out, 0, sizeof(*out));
+  memcpy(out, ts_ev_attr_data(stats), len);
+  return 1;
+}
+
+/* Resolve the TASKSTATS generic netlink family id, or 0. */
+static uint16_t ts_ev_stats_resolve(int sock) {
+  static const char name[] = TASKSTATS_GENL_NAME;
+  long buf[8192 / sizeof(long)];
+  const struct nlmsghdr *h = NULL;
+  const struct nlattr *id = NULL;
+  int ok = 1;
+
+  if (!ts_ev_genl_send(sock, GENL_ID_CTRL, CTRL_CMD_GETFAMILY,
+                       CTRL_ATTR_FAMILY_NAME, name, sizeof(name), 0)) {
+    return 0;
+  }
+  h = ts_ev_genl_reply(sock, buf, sizeof(buf), GENL_ID_CTRL, &ok);
+  if (!h || !ok || h->nlmsg_len < NLMSG_LENGTH(GENL_HDRLEN)) return 0;
+  id = ts_ev_attr((const char *)NLMSG_DATA(h) + GENL_HDRLEN,
+                  h->nlmsg_len - NLMSG_LENGTH(GENL_HDRLEN),
+                  CTRL_ATTR_FAMILY_ID);
+  if (!id || ts_ev_attr_len(id) < sizeof(uint16_t)) return 0;
+  return *(const uint16_t *)ts_ev_attr_data(id);
+}
+
+/* CPU list the kernel accepts as a listener mask, e.g. "0-7". */
+static void ts_ev_cpu_list(char *out, size_t len) {
+  int fd = open("/sys/devices/system/cpu/possible", O_RDONLY | O_CLOEXEC);
+  ssize_t n = -1;
+
+  if (fd >= 0) {
+    n = read(fd, out, len - 1);
+    close(fd);
+  }
+  while (n > 0 && (out[n - 1] == '\n' || out[n - 1] == ' ')) n--;
+  if (n > 0) {
+    out[n] = '\0';
+  } else {
+    snprintf(out, len, "0-%zu", ts_driver_core_count() - 1);
+  }
+}
+
+/*
+ * Open a taskstats socket registered for exit records on every CPU, or -1.
+ * Kernels older than TS_EV_TASKSTATS_MIN_VERSION are refused because their
+ * records cannot tell the last thread of a group from any other.
+ */
+static int ts_ev_stats_open(void) {
+  struct sockaddr_nl addr;
+  struct timeval timeout = {1, 0};
+  struct taskstats stats;
+  long buf[8192 / sizeof(long)];
+  const struct nlmsghdr *h = NULL;
+  char cpus[256];
+  uint32_t self = (uint32_t)getpid();
+  int rcvbuf = TS_EV_RCVBUF;
+  int ok = 1;
+  int sock = socket(AF_NETLINK, SOCK_RAW | SOCK_CLOEXEC, NETLINK_GENERIC);
+
+  if (sock < 0) return -1;
+  setsockopt(sock, SOL_SOCKET, SO_RCVBUF, &rcvbuf, sizeof(rcvbuf));
+  /* Setup replies are bounded; the listener itself blocks in poll */
+  setsockopt(sock, SOL_SOCKET, SO_RCVTIMEO, &timeout, sizeof(timeout));
+
+  memset(&addr, 0, sizeof(addr));
+  addr.nl_family = AF_NETLINK;
+  if (bind(sock, (struct sockaddr *)&addr, sizeof(addr)) < 0) ok = 0;
+  if (ok) ok = (ts_ev_stats_family = ts_ev_stats_resolve(sock)) != 0;
+
+  /* Our own record tells the kernel's struct version */
+  if (ok) {
+    ok = ts_ev_genl_send(sock, ts_ev_stats_family, TASKSTATS_CMD_GET,
+                         TASKSTATS_CMD_ATTR_PID, &self, sizeof(self), 0);
+  }
+  if (ok) h = ts_ev_genl_reply(sock, buf, sizeof(buf), ts_ev_stats_family, &ok);
+  if (ok) {
+    ok = h && ts_ev_task_stats(h, &stats) &&
+         stats.version >= TS_EV_TASKSTATS_MIN_VERSION;
+  }
+
+  if (ok) {
+    ts_ev_cpu_list(cpus, sizeof(cpus));
+    ok = ts_ev_genl_send(sock, ts_ev_stats_family, TASKSTATS_CMD_GET,
+                         TASKSTATS_CMD_ATTR_REGISTER_CPUMASK, cpus,
+                         strlen(cpus) + 1, NLM_F_ACK);
+  }
+  /* Exit records may arrive ahead of the ack; they are skipped */
+  if (ok) ts_ev_genl_reply(sock, buf, sizeof(buf), NLMSG_ERROR, &ok);
+
+  if (!ok) {
+    close(sock);
+    return -1;
+  }
+  timeout.tv_sec = 0;
+  setsockopt(sock, SOL_SOCKET, SO_RCVTIMEO, &timeout, sizeof(timeout));
+  return sock;
+}
+
+/* Boot-relative ns of a CLOCK_MONOTONIC reading, or now when mono_ns is 0. */
+static double ts_ev_boottime_ns(double mono_ns) {
+  struct timespec boot, mono;
+
+  clock_gettime(CLOCK_BOOTTIME, &boot);
+  clock_gettime(CLOCK_MONOTONIC, &mono);
+  if (mono_ns <= 0.0) return (double)boot.tv_sec * 1e9 + (double)boot.tv_nsec;
+  /* The two clocks differ by time spent suspended, constant in between */
+  return mono_ns + ((double)boot.tv_sec - (double)mono.tv_sec) * 1e9 +
+         ((double)boot.tv_nsec - (double)mono.tv_nsec);
+}
+
+/* starttime of /proc/<pid>/stat in ns, as the driver reports it. */
+static int ts_ev_read_start(pid_t pid, double *start_ns) {
+  char path[64];
+  char buf[1024];
+  const char *p = NULL;
+  unsigned long long ticks = 0;
+  ssize_t n = -1;
+  int fd = -1;
+
+  snprintf(path, sizeof(path), "/proc/%d/stat", pid);
+  fd = open(path, O_RDONLY | O_CLOEXEC);
+  if (fd < 0) return 0;
+  n = read(fd, buf, sizeof(buf) - 1);
+  close(fd);
+  if (n <= 0) return 0;
+  buf[n] = '\0';
+
+  /* Field 22; comm may hold spaces and parens, so count from the last ')' */
+  p = strrchr(buf, ')');
+  for (int field = 2; p && field < 22; ++field) p = strchr(p + 1, ' ');
+  if (!p || sscanf(p + 1, "%llu", &ticks) != 1) return 0;
+  *start_ns = (double)ticks * ts_ev_tick_ns;
+  return 1;
+}
+
+static size_t ts_ev_proc_hash(pid_t tgid) {
+  return ((uint32_t)tgid * 2654435761u) & (ts_ev_procs_cap - 1);
+}
+
+/* Slot holding tgid, or the free slot where it would go. */
+static size_t ts_ev_proc_slot(pid_t tgid) {
+  size_t i = ts_ev_proc_hash(tgid);
+  while (ts_ev_procs[i].tgid != 0 && ts_ev_procs[i].tgid != tgid) {
+    i = (i + 1) & (ts_ev_procs_cap - 1);
+  }
+  return i;
+}
+
+static struct ts_ev_proc *ts_ev_proc_find(pid_t tgid) {
+  if (ts_ev_procs_len == 0) return NULL;
+  size_t i = ts_ev_proc_slot(tgid);
+  return ts_ev_procs[i].tgid == tgid ? &ts_ev_procs[i] : NULL;
+}
+
+/* Keep the table at most half full; returns 0 on allocation failure. */
+static int ts_ev_procs_reserve(size_t len) {
+  struct ts_ev_proc *old = ts_ev_procs;
+  size_t old_cap = ts_ev_procs_cap;
+  size_t cap = old_cap ? old_cap : 1024;
+
+  while (cap < 2 * len) cap *= 2;
+  if (cap == old_cap) return 1;
+  ts_ev_procs = calloc(cap, sizeof(*ts_ev_procs));
+  if (!ts_ev_procs) {
+    ts_ev_procs = old;
+    return 0;
+  }
+  ts_ev_procs_cap = cap;
+  for (size_t i = 0; i < old_cap; ++i) {
+    if (old[i].tgid != 0) ts_ev_procs[ts_ev_proc_slot(old[i].tgid)] = old[i];
+  }
+  free(old);
+  return 1;
+}
+
+static void ts_ev_group_release(int group) {
+  if (group < 0) return;
+  ts_ev_groups[group].tgid = 0;
+  ts_ev_group_free[ts_ev_group_nfree++] = group;
+}
+
+/* Remove the entry in slot i, shifting its probe chain back over the hole. */
+static void ts_ev_proc_remove(size_t i) {
+  size_t mask = ts_ev_procs_cap - 1;
+  size_t j = i;
+
+  ts_ev_group_release(ts_ev_procs[i].group);
+  for (;;) {
+    j = (j + 1) & mask;
+    if (ts_ev_procs[j].tgid == 0) break;
+    /* Entry j may fill the hole unless its home lies cyclically in (i, j] */
+    size_t home = ts_ev_proc_hash(ts_ev_procs[j].tgid);
+    if (((j - home) & mask) < ((j - i) & mask)) continue;
+    ts_ev_procs[i] = ts_ev_procs[j];
+    i = j;
+  }
+  ts_ev_procs[i].tgid = 0;
+  ts_ev_procs_len--;
+}
+
+/* Record a process's start; a reused tgid drops what its predecessor left. */
+static struct ts_ev_proc *ts_ev_proc_put(pid_t tgid, double start_ns) {
+  struct ts_ev_proc *p = ts_ev_proc_find(tgid);
+
+  if (p && p->start_ns == start_ns) return p;
+  if (p) {
+    ts_ev_group_release(p->group);
+  } else {
+    if (!ts_ev_procs_reserve(ts_ev_procs_len + 1)) return NULL;
+    p = &ts_ev_procs[ts_ev_proc_slot(tgid)];
+    p->tgid = tgid;
+    ts_ev_procs_len++;
+  }
+  p->group = -1;
+  p->start_ns = start_ns;
+  return p;
+}
+
+static int ts_ev_gone(pid_t tgid) {
+  return kill(tgid, 0) < 0 && errno == ESRCH;
+}
+
+/* Drop entries whose process no longer exists (exit records were lost). */
+static void ts_ev_procs_sweep(void) {
+  size_t i = 0;
+  while (i < ts_ev_procs_cap) {
+    /* A removal shifts a later entry into slot i; look at it again */
+    if (ts_ev_procs[i].tgid != 0 && ts_ev_gone(ts_ev_procs[i].tgid)) {
+      ts_ev_proc_remove(i);
+    } else {
+      i++;
+    }
+  }
+}
+
+/* Seed the table with every running process (before the first fork event). */
+static void ts_ev_procs_seed(void) {
+  DIR *dir = opendir("/proc");
+  struct dirent *ent = NULL;
+
+  if (!dir) return;
+  while ((ent = readdir(dir)) != NULL) {
+    pid_t pid = (pid_t)atoi(ent->d_name);
+    double start_ns = 0.0;
+    if (pid > 0 && ts_ev_read_start(pid, &start_ns)) {
+      ts_ev_proc_put(pid, start_ns);
+    }
+  }
+  closedir(dir);
+}
+
+/* A new process: its start from /proc, or the fork time once it is reaped. */
+static void ts_ev_proc_forked(pid_t tgid, unsigned long long fork_ns) {
+  double start_ns = 0.0;
+
+  if (!ts_ev_read_start(tgid, &start_ns)) {
+    start_ns = floor(ts_ev_boottime_ns((double)fork_ns) / ts_ev_tick_ns) *
+               ts_ev_tick_ns;
+  }
+  ts_ev_proc_put(tgid, start_ns);
+}
+
+/*
+ * The start of the group an exit record belongs to. The record's own
+ * ac_tgetime only bounds it from above (delivery delay shifts an estimate),
+ * so the cached value is used unless it is newer than that bound, i.e.
+ * belongs to a later process with the same tgid. Returns NULL when the
+ * start cannot be established.
+ */
+static struct ts_ev_proc *ts_ev_proc_exiting(const struct taskstats *s) {
+  pid_t tgid = (pid_t)s->ac_tgid;
+  double latest = ts_ev_boottime_ns(0.0) - (double)s->ac_tgetime * 1e3 +
+                  ts_ev_tick_ns;
+  struct ts_ev_proc *p = ts_ev_proc_find(tgid);
+  double start_ns = 0.0;
+
+  if (p && p->start_ns <= latest) return p;
+  /* Missed fork (overrun): the group may still be readable */
+  if (!ts_ev_read_start(tgid, &start_ns) || start_ns > latest) return NULL;
+  return ts_ev_proc_put(tgid, start_ns);
+}
+
+/* Return freed group slots of processes that no longer exist, except keep. */
+static size_t ts_ev_groups_reclaim(pid_t keep) {
+  size_t freed = 0;
+  for (size_t g = 0; g < TS_EV_GROUPS; ++g) {
+    pid_t tgid = ts_ev_groups[g].tgid;
+    struct ts_ev_proc *p = NULL;
+    if (tgid == 0 || tgid == keep || !ts_ev_gone(tgid)) continue;
+    p = ts_ev_proc_find(tgid);
+    if (p) {
+      ts_ev_proc_remove((size_t)(p - ts_ev_procs));
+    } else {
+      ts_ev_group_release((int)g);
+    }
+    freed++;
+  }
+  return freed;
+}
+
+/*
+ * A group slot for tgid. When all are taken, slots of processes that are
+ * gone are reclaimed first; if none are, a live group is evicted (its
+ * earlier threads then drop out of its exit row) and counted. A scan that
+ * frees nothing is not repeated for the next TS_EV_GROUPS / 8 allocations.
+ */
+static int ts_ev_group_alloc(pid_t tgid) {
+  int g = -1;
+
+  if (ts_ev_group_nfree == 0 && ts_ev_reclaim_wait == 0 &&
+      ts_ev_groups_reclaim(tgid) == 0) {
+    ts_ev_reclaim_wait = TS_EV_GROUPS / 8;
+  }
+  if (ts_ev_group_nfree == 0) {
+    if (ts_ev_reclaim_wait > 0) ts_ev_reclaim_wait--;
+    while (ts_ev_groups[ts_ev_group_victim].tgid == tgid) {
+      ts_ev_group_victim = (ts_ev_group_victim + 1) % TS_EV_GROUPS;
+    }
+    struct ts_ev_proc *victim =
+        ts_ev_proc_find(ts_ev_groups[ts_ev_group_victim].tgid);
+    if (victim) victim->group = -1;
+    ts_ev_group_release((int)ts_ev_group_victim);
+    ts_ev_group_victim = (ts_ev_group_victim + 1) % TS_EV_GROUPS;
+    ts_ev_count(TS_EV_EVICTED);
+  }
+
+  g = ts_ev_group_free[--ts_ev_group_nfree];
+  memset(&ts_ev_groups[g], 0, sizeof(ts_ev_groups[g]));
+  ts_ev_groups[g].tgid = tgid;
+  return g;
+}
+
+/* Map a taskstats record onto the metric catalog. */
+static void ts_ev_stats_row(const struct taskstats *s, double start_ns,
+                            double *metrics) {
+  int nice = (int8_t)s->ac_nice;
+  int fair = s->ac_sched == SCHED_OTHER || s->ac_sched == SCHED_BATCH ||
+             s->ac_sched == SCHED_IDLE;
+
+  metrics[TS_UTIME] = (double)s->ac_utime * 1e3;
+  metrics[TS_STIME] = (double)s->ac_stime * 1e3;
+  /* The address space is gone by the time the record is written */
+  metrics[TS_RSS] = 0.0;
+  metrics[TS_VSIZE] = 0.0;
+  metrics[TS_NUM_THREADS] = 0.0;
+  metrics[TS_VOL_CTX_SWITCHES] = (double)s->nvcsw;
+  metrics[TS_NONVOL_CTX_SWITCHES] = (double)s->nivcsw;
+  metrics[TS_PROCESSOR] = -1.0;
+  metrics[TS_IO_READ_BYTES] = (double)s->read_bytes;
+  metrics[TS_IO_WRITE_BYTES] = (double)s->write_bytes;
+  metrics[TS_STARTTIME] = start_ns;
+  metrics[TS_UID] = (double)s->ac_uid;
+  metrics[TS_PPID] = (double)s->ac_ppid;
+  metrics[TS_PRIORITY] = fair ? (double)(20 + nice) : -1.0;
+  metrics[TS_NICE] = (double)nice;
+  metrics[TS_MINFLT] = (double)s->ac_minflt;
+  metrics[TS_MAJFLT] = (double)s->ac_majflt;
+}
+
+/*
+ * Taskstats sends one record per exiting thread, computed in do_exit before
+ * the task is released, so nothing can be reaped away. The per-tgid record
+ * only aggregates delay accounting, so a group's counters are the sum of its
+ * threads' records; the one flagged AGROUP (last thread out, whichever it
+ * is) completes the row. Threads that exited before the listener started
+ * are not in the sum.
+ */
+static void ts_ev_stats_exit(const struct taskstats *s) {
+  pid_t tgid = (pid_t)s->ac_tgid;
+  struct ts_ev_proc *p = ts_ev_proc_exiting(s);
+  double metrics[TS_METRIC_COUNT];
+
+  if (!p) {
+    /* Without a start the row could not be keyed; a thread's share is lost */
+    if (s->ac_flag & AGROUP) ts_ev_queue(tgid, NULL);
+    return;
+  }
+  ts_ev_stats_row(s, p->start_ns, metrics);
+
+  if (!(s->ac_flag & AGROUP)) {
+    if (p->group < 0) {
+      int g = ts_ev_group_alloc(tgid);
+      /* Reclaiming may have moved the entry */
+      p = ts_ev_proc_find(tgid);
+      p->group = g;
+    }
+    for (size_t m = 0; m < TS_METRIC_COUNT; ++m) {
+      if (ts_is_counter_metric(m)) ts_ev_groups[p->group].sums[m] += metrics[m];
+    }
+    return;
+  }
+
+  if (p->group >= 0) {
+    for (size_t m = 0; m < TS_METRIC_COUNT; ++m) {
+      if (ts_is_counter_metric(m)) metrics[m] += ts_ev_groups[p->group].sums[m];
+    }
+  }
+  ts_ev_proc_remove((size_t)(p - ts_ev_procs));
+  ts_ev_queue(tgid, metrics);
+}
+
+/* 1 unless a task of tgid other than pid is still running. */
+static int ts_ev_group_dead(pid_t tgid, pid_t pid) {
+  char path[64];
+  char buf[512];
+  DIR *dir = NULL;
+  struct dirent *ent = NULL;
+  int dead = 1;
+
+  snprintf(path, sizeof(path), "/proc/%d/task", tgid);
+  dir = opendir(path);
+  if (!dir) return 1;
+  while (dead && (ent = readdir(dir)) != NULL) {
+    pid_t tid = (pid_t)atoi(ent->d_name);
+    const char *paren = NULL;
+    ssize_t n = -1;
+    int fd = -1;
+
+    if (tid <= 0 || tid == pid) continue;
+    snprintf(path, sizeof(path), "/proc/%d/task/%d/stat", tgid, tid);
+    fd = open(path, O_RDONLY | O_CLOEXEC);
+    if (fd < 0) continue;
+    n = read(fd, buf, sizeof(buf) - 1);
+    close(fd);
+    if (n <= 0) continue;
+    buf[n] = '\0';
+    paren = strrchr(buf, ')');
+    if (paren && paren[1] == ' ' && paren[2] != 'Z' && paren[2] != 'X') {
+      dead = 0;
+    }
+  }
+  closedir(dir);
+  return dead;
+}
+
+/*
+ * Fallback without taskstats: the connector's exit event is sent after
+ * exit_notify, so the parent may already have reaped the process and the
+ * exit is then counted as missed. Only the last running task of a group
+ * triggers the read, which also covers a leader that exited first.
+ */
+static void ts_ev_proc_exit(pid_t pid, pid_t tgid) {
+  double metrics[TS_METRIC_COUNT];
+
+  if (!ts_ev_group_dead(tgid, pid)) return;
+  if (!ts_driver_read_pid(tgid, metrics)) {
+    ts_ev_queue(tgid, NULL);
+    return;
+  }
+  /* Two last threads exiting together both see a dead group */
+  if (tgid == ts_ev_last_tgid && metrics[TS_STARTTIME] == ts_ev_last_start) {
+    return;
+  }
+  ts_ev_last_tgid = tgid;
+  ts_ev_last_start = metrics[TS_STARTTIME];
+  ts_ev_queue(tgid, metrics);
+}
+
+static void ts_ev_handle(const struct proc_event *ev) {
+  switch (ev->what) {
+  case PROC_EVENT_FORK:
+    /* Thread clones also arrive as forks */
+    if (ev->event_data.fork.child_pid == ev->event_data.fork.child_tgid) {
+      ts_ev_count(TS_EV_FORKS);
+      if (ts_ev_stats_sock >= 0) {
+        ts_ev_proc_forked(ev->event_data.fork.child_tgid, ev->timestamp_ns);
+      }
+    }
+    break;
+  case PROC_EVENT_EXEC:
+    ts_ev_count(TS_EV_EXECS);
+    break;
+  case PROC_EVENT_EXIT:
+    if (ts_ev_stats_sock < 0) {
+      ts_ev_proc_exit(ev->event_data.exit.process_pid,
+                      ev->event_data.exit.process_tgid);
+    }
+    break;
+  default:
+    break;
+  }
+}
+
+/* An overrun lost an unknown number of events or records */
+static void ts_ev_overrun(void) {
+  ts_ev_count(TS_EV_DROPPED);
+  ts_ev_sweep_due = 1;
+}
+
+/*
+ * Both readers return 1 after a batch or a recoverable error, 0 when
+ * nothing is pending (MSG_DONTWAIT), and -1 when the socket is unusable.
+ */
+static int ts_ev_read_connector(long *buf, size_t size, int flags) {
+  int len = (int)recv(ts_ev_sock, buf, size, flags);
+
+  if (len < 0) {
+    if (errno == ENOBUFS) ts_ev_overrun();
+    if (errno == EAGAIN || errno == EWOULDBLOCK) return 0;
+    return (errno == ENOBUFS || errno == EINTR) ? 1 : -1;
+  }
+  for (struct nlmsghdr *h = (struct nlmsghdr *)buf; NLMSG_OK(h, len);
+       h = NLMSG_NEXT(h, len)) {
+    const struct cn_msg *cn = NLMSG_DATA(h);
+    struct proc_event ev;
+    if (h->nlmsg_type == NLMSG_ERROR || h->nlmsg_type == NLMSG_NOOP) continue;
+    if (cn->id.idx != CN_IDX_PROC || cn->id.val != CN_VAL_PROC) continue;
+    if (cn->len < sizeof(struct proc_event)) continue;
+    /* cn->data is only 4-byte aligned */
+    memcpy(&ev, cn->data, sizeof(ev));
+    ts_ev_handle(&ev);
+  }
+  return 1;
+}
+
+static int ts_ev_read_stats(long *buf, size_t size) {
+  struct taskstats stats;
+  int len = (int)recv(ts_ev_stats_sock, buf, size, 0);
+
+  if (len < 0) {
+    if (errno == ENOBUFS) ts_ev_overrun();
+    if (errno == EAGAIN || errno == EWOULDBLOCK) return 0;
+    return (errno == ENOBUFS || errno == EINTR) ? 1 : -1;
+  }
+  for (struct nlmsghdr *h = (struct nlmsghdr *)buf; NLMSG_OK(h, len);
+       h = NLMSG_NEXT(h, len)) {
+    if (h->nlmsg_type != ts_ev_stats_family) continue;
+    if (ts_ev_task_stats(h, &stats)) ts_ev_stats_exit(&stats);
+  }
+  return 1;
+}
+
+static void *ts_ev_main(void *arg) {
+  long buf[8192 / sizeof(long)]; /* aligned for nlmsghdr */
+  struct pollfd fds[3];
+  int ok = 1;
+
+  (void)arg;
+  fds[0].fd = ts_ev_wake[0];
+  fds[0].events = POLLIN;
+  fds[1].fd = ts_ev_sock;
+  fds[1].events = POLLIN;
+  fds[2].fd = ts_ev_stats_sock; /* ignored by poll when -1 */
+  fds[2].events = POLLIN;
+
+  /* Forks from here on are queued on the connector and update the seed */
+  if (ts_ev_stats_sock >= 0) ts_ev_procs_seed();
+
+  while (ok) {
+    if (poll(fds, 3, -1) < 0) {
+      if (errno == EINTR) continue;
+      break;
+    }
+    if (fds[0].revents) break;
+    /* POLLERR also flags an overrun, which recv reports and clears */
+    if (fds[1].revents) ok = ts_ev_read_connector(buf, sizeof(buf), 0) >= 0;
+    if (ok && fds[2].revents) {
+      /* A process's fork event is sent before it can run, hence before its
+       * exit record: take pending events first so its start is known */
+      int r = 0;
+      while ((r = ts_ev_read_connector(buf, sizeof(buf), MSG_DONTWAIT)) > 0) {
+      }
+      ok = r == 0;
+      if (ok && ts_ev_read_stats(buf, sizeof(buf)) < 0) {
+        /* Carry on from /proc rather than lose every exit */
+        close(ts_ev_stats_sock);
+        ts_ev_stats_sock = fds[2].fd = -1;
+      }
+    }
+    if (ts_ev_sweep_due && ts_ev_stats_sock >= 0) {
+      /* At most once a second: overruns come in bursts */
+      double now = ts_get_monotonic_time(0);
+      if (now - ts_ev_swept_at >= 1.0) {
+        ts_ev_procs_sweep();
+        ts_ev_sweep_due = 0;
+        ts_ev_swept_at = now;
+      }
+    }
+  }
+  return NULL;
+}
+
+static void ts_ev_release(void) {
+  if (ts_ev_sock >= 0) close(ts_ev_sock);
+  if (ts_ev_stats_sock >= 0) close(ts_ev_stats_sock);
+  if (ts_ev_wake[0] >= 0) close(ts_ev_wake[0]);
+  if (ts_ev_wake[1] >= 0) close(ts_ev_wake[1]);
+  ts_ev_sock = -1;
+  ts_ev_stats_sock = -1;
+  ts_ev_wake[0] = ts_ev_wake[1] = -1;
+
+  pthread_mutex_lock(&ts_ev_lock);
+  free(ts_ev_rows);
+  free(ts_ev_pids);
+  ts_ev_rows = NULL;
+  ts_ev_pids = NULL;
+  ts_ev_cap = ts_ev_head = ts_ev_len = 0;
+  pthread_mutex_unlock(&ts_ev_lock);
+
+  free(ts_ev_procs);
+  ts_ev_procs = NULL;
+  ts_ev_procs_cap = ts_ev_procs_len = 0;
+}
+
+int ts_driver_events_start(size_t capacity) {
+  int ok = 0;
+
+  if (capacity == 0) return 0;
+
+  pthread_mutex_lock(&ts_ev_ctl);
+  if (ts_ev_running) {
+    pthread_mutex_unlock(&ts_ev_ctl);
+    return 1;
+  }
+
+  pthread_mutex_lock(&ts_ev_lock);
+  ts_ev_rows = malloc(capacity * TS_METRIC_COUNT * sizeof(double));
+  ts_ev_pids = malloc(capacity * sizeof(double));
+  ts_ev_cap = capacity;
+  ts_ev_head = ts_ev_len = 0;
+  memset(ts_ev_counts, 0, sizeof(ts_ev_counts));
+  ok = ts_ev_rows && ts_ev_pids;
+  pthread_mutex_unlock(&ts_ev_lock);
+
+  memset(ts_ev_groups, 0, sizeof(ts_ev_groups));
+  for (size_t g = 0; g < TS_EV_GROUPS; ++g) {
+    ts_ev_group_free[g] = (int)(TS_EV_GROUPS - 1 - g);
+  }
+  ts_ev_group_nfree = TS_EV_GROUPS;
+  ts_ev_group_victim = ts_ev_reclaim_wait = 0;
+  ts_ev_sweep_due = 0;
+  ts_ev_swept_at = 0.0;
+  ts_ev_last_tgid = 0;
+  ts_ev_last_start = -1.0;
+  if (ts_ev_tick_ns == 0.0) {
+    long hz = sysconf(_SC_CLK_TCK);
+    ts_ev_tick_ns = 1e9 / (double)(hz > 0 ? hz : 100);
+  }
+
+  if (ok) ok = pipe2(ts_ev_wake, O_CLOEXEC) == 0;
+  if (ok) ok = (ts_ev_sock = ts_ev_open()) >= 0;
+  /* Optional: without it exits are read from /proc */
+  if (ok) ts_ev_stats_sock = ts_ev_stats_open();
+  if (ok) ok = pthread_create(&ts_ev_thread, NULL, ts_ev_main, NULL) == 0;
+
+  if (ok) {
+    ts_ev_running = 1;
+  } else {
+    ts_ev_release();
+  }
+  pthread_mutex_unlock(&ts_ev_ctl);
+  return ok;
+}
+
+void ts_driver_events_stop(void) {
+  char byte = 0;
+
+  pthread_mutex_lock(&ts_ev_ctl);
+  if (ts_ev_running) {
+    while (write(ts_ev_wake[1], &byte, 1) < 0 && errno == EINTR) {
+    }
+    pthread_join(ts_ev_thread, NULL);
+    ts_ev_release();
+    ts_ev_running = 0;
+  }
+  pthread_mutex_unlock(&ts_ev_ctl);
+}
+
+size_t ts_driver_events_drain(double *out, size_t max_rows,
+                              const struct ts_layout *layout, double *pid_out) {
+  size_t row = 0;
+
+  if (!out || !layout) return 0;
+
+  pthread_mutex_lock(&ts_ev_lock);
+  while (row < max_rows && ts_ev_len > 0) {
+    const double *src = ts_ev_rows + ts_ev_head * TS_METRIC_COUNT;
+    double *row_ptr = out + row * layout->row_stride;
+    for (size_t m = 0; m < TS_METRIC_COUNT; ++m) {
+      row_ptr[m * layout->col_stride] = src[m];
+    }
+    if (pid_out) pid_out[row] = ts_ev_pids[ts_ev_head];
+    ts_ev_head = (ts_ev_head + 1) % ts_ev_cap;
+    ts_ev_len--;
+    row++;
+  }
+  pthread_mutex_unlock(&ts_ev_lock);
+  return row;
+}
+
+size_t ts_driver_events_stats(double *out, size_t n) {
+  if (!out) return 0;
+  if (n > TS_EV_STAT_COUNT) n = TS_EV_STAT_COUNT;
+
+  pthread_mutex_lock(&ts_ev_lock);
+  for (size_t i = 0; i < n; ++i) {
+    out[i] = (double)ts_ev_counts[i];
+  }
+  pthread_mutex_unlock(&ts_ev_lock);
+  return n;
+}
@@ -0,0 +1,678 @@
+#include "driver.h"
+
+#include <math.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+
+/*
+ * DDSketch: value x > 0 lands in bin ceil(log_gamma(x)), gamma =
+ * (1 + alpha) / (1 - alpha), so any quantile is within alpha relative error.
+ * Negative values use a mirrored store; |x| below TS_SKETCH_MIN_VALUE counts
+ * as zero. A store holding more than TS_SKETCH_MAX_BINS bins folds its
+ * lowest bins together, which only affects the smallest magnitudes.
+ */
+#define TS_SKETCH_MAX_BINS 2048
+#define TS_SKETCH_MIN_VALUE 1e-9
+/* Bound on bin indexes, for tiny alpha, infinite values and decoded stores */
+#define TS_SKETCH_MAX_INDEX (1 << 30)
+#define TS_SKETCH_MAGIC 0x324b5354u /* "TSK2" */
+
+struct ts_sketch_store {
+  int32_t offset; /* bin index of bins[0] */
+  uint32_t len;
+  uint32_t *bins;
+};
+
+struct ts_sketch {
+  double count;
+  double zero;
+  double min;
+  double max;
+  struct ts_sketch_store pos;
+  struct ts_sketch_store neg;
+};
+
+struct ts_sketch_key {
+  double pid;
+  double start;
+};
+
+/* Update numbers: the last one that held the identity (0 = none), and that
+ * or the one it was created after, whichever is later. group is the key the
+ * caller last gave it, whose row (group, 0) it folds into on exit. */
+struct ts_sketch_life {
+  uint64_t seen;
+  uint64_t touched;
+  double group;
+};
+
+struct ts_sketch_set {
+  double alpha;
+  double gamma;
+  double log_gamma;
+  size_t nmetrics;
+  size_t metrics[TS_METRIC_COUNT];
+  /* Updates an identity may be missing from before it is folded; 0 = never */
+  uint64_t exit_updates;
+  /* Identities in first-seen order; sketches[i * nmetrics + slot] */
+  struct ts_sketch_key *keys;
+  struct ts_sketch_life *life;
+  struct ts_sketch *sketches;
+  uint64_t updates;
+  size_t count;
+  size_t cap;
+  /* Open addressing over keys: entry + 1, 0 when empty */
+  size_t *index;
+  size_t index_cap;
+};
+
+static size_t ts_sketch_hash(double pid, double start) {
+  uint64_t a = 0;
+  uint64_t b = 0;
+  memcpy(&a, &pid, sizeof(a));
+  memcpy(&b, &start, sizeof(b));
+  uint64_t h = (a * 0x9e3779b97f4a7c15ull) ^ (b + (a << 6) + (a >> 2));
+  h ^= h >> 29;
+  return (size_t)(h * 0xbf58476d1ce4e5b9ull);
+}
+
+static int ts_sketch_reindex(struct ts_sketch_set *s, size_t cap) {
+  size_t *index = calloc(cap, sizeof(*index));
+  if (!index) return 0;
+  for (size_t i = 0; i < s->count; ++i) {
+    size_t h = ts_sketch_hash(s->keys[i].pid, s->keys[i].start) & (cap - 1);
+    while (index[h]) h = (h + 1) & (cap - 1);
+    index[h] = i + 1;
+  }
+  free(s->index);
+  s->index = index;
+  s->index_cap = cap;
+  return 1;
+}
+
+/* Sketch row for an identity, created empty in group on first sight; NULL
+ * on OOM. */
+static struct ts_sketch *ts_sketch_row(struct ts_sketch_set *s, double pid,
+                                       double start, double group) {
+  if (2 * (s->count + 1) > s->index_cap) {
+    if (!ts_sketch_reindex(s, s->index_cap ? 2 * s->index_cap : 64)) {
+      return NULL;
+    }
+  }
+
+  size_t h = ts_sketch_hash(pid, start) & (s->index_cap - 1);
+  while (s->index[h]) {
+    size_t i = s->index[h] - 1;
+    if (s->keys[i].pid == pid && s->keys[i].start == start) {
+      return s->sketches + i * s->nmetrics;
+    }
+    h = (h + 1) & (s->index_cap - 1);
+  }
+
+  if (s->count == s->cap) {
+    size_t cap = s->cap ? 2 * s->cap : 64;
+    struct ts_sketch_key *keys = realloc(s->keys, cap * sizeof(*keys));
+    if (!keys) return NULL;
+    s->keys = keys;
+    struct ts_sketch_life *life = realloc(s->life, cap * sizeof(*life));
+    if (!life) return NULL;
+    s->life = life;
+    struct ts_sketch *sk =
+        realloc(s->sketches, cap * s->nmetrics * sizeof(*sk));
+    if (!sk) return NULL;
+    s->sketches = sk;
+    s->cap = cap;
+  }
+
+  struct ts_sketch *row = s->sketches + s->count * s->nmetrics;
+  memset(row, 0, s->nmetrics * sizeof(*row));
+  s->keys[s->count].pid = pid;
+  s->keys[s->count].start = start;
+  s->life[s->count].seen = 0;
+  s->life[s->count].touched = s->updates;
+  s->life[s->count].group = group;
+  s->index[h] = ++s->count;
+  return row;
+}
+
+/* Make the store cover [lo, hi], folding bins below the cap into its floor. */
+static int ts_sketch_cover(struct ts_sketch_store *st, int32_t lo,
+                           int32_t hi) {
+  if (st->len) {
+    int32_t top = st->offset + (int32_t)st->len - 1;
+    if (st->offset < lo) lo = st->offset;
+    if (top > hi) hi = top;
+  }
+  if ((int64_t)hi - lo + 1 > TS_SKETCH_MAX_BINS) {
+    lo = hi - TS_SKETCH_MAX_BINS + 1;
+  }
+
+  uint32_t len = (uint32_t)(hi - lo + 1);
+  if (st->len && lo == st->offset && len == st->len) return 1;
+
+  uint32_t *bins = calloc(len, sizeof(*bins));
+  if (!bins) return 0;
+  for (uint32_t k = 0; k < st->len; ++k) {
+    int32_t i = st->offset + (int32_t)k;
+    bins[(i < lo ? lo : i) - lo] += st->bins[k];
+  }
+  free(st->bins);
+  st->bins = bins;
+  st->offset = lo;
+  st->len = len;
+  return 1;
+}
+
+static int ts_sketch_store_add(struct ts_sketch_store *st, int32_t i,
+                               uint32_t n) {
+  if (!ts_sketch_cover(st, i, i)) return 0;
+  if (i < st->offset) i = st->offset;
+  st->bins[i - st->offset] += n;
+  return 1;
+}
+
+static int ts_sketch_store_merge(struct ts_sketch_store *dst,
+                                 const struct ts_sketch_store *src) {
+  if (src->len == 0) return 1;
+  if (!ts_sketch_cover(dst, src->offset,
+                       src->offset + (int32_t)src->len - 1)) {
+    return 0;
+  }
+  for (uint32_t k = 0; k < src->len; ++k) {
+    int32_t i = src->offset + (int32_t)k;
+    dst->bins[(i < dst->offset ? dst->offset : i) - dst->offset] +=
+        src->bins[k];
+  }
+  return 1;
+}
+
+static void ts_sketch_store_free(struct ts_sketch_store *st) {
+  free(st->bins);
+  memset(st, 0, sizeof(*st));
+}
+
+static int ts_sketch_add(const struct ts_sketch_set *s, struct ts_sketch *k,
+                         double v) {
+  double mag = fabs(v);
+
+  if (k->count == 0 || v < k->min) k->min = v;
+  if (k->count == 0 || v > k->max) k->max = v;
+  k->count += 1;
+  if (mag < TS_SKETCH_MIN_VALUE) {
+    k->zero += 1;
+    return 1;
+  }
+  double i = ceil(log(mag) / s->log_gamma);
+  if (i > TS_SKETCH_MAX_INDEX) i = TS_SKETCH_MAX_INDEX;
+  if (i < -TS_SKETCH_MAX_INDEX) i = -TS_SKETCH_MAX_INDEX;
+  return ts_sketch_store_add(v > 0 ? &k->pos : &k->neg, (int32_t)i, 1);
+}
+
+static int ts_sketch_merge_one(struct ts_sketch *dst,
+                               const struct ts_sketch *src) {
+  if (src->count == 0) return 1;
+  if (dst->count == 0 || src->min < dst->min) dst->min = src->min;
+  if (dst->count == 0 || src->max > dst->max) dst->max = src->max;
+  dst->count += src->count;
+  dst->zero += src->zero;
+  return ts_sketch_store_merge(&dst->pos, &src->pos) &&
+         ts_sketch_store_merge(&dst->neg, &src->neg);
+}
+
+static double ts_sketch_bin_value(const struct ts_sketch_set *s, int32_t i) {
+  return 2.0 * exp((double)i * s->log_gamma) / (s->gamma + 1.0);
+}
+
+/* Bin value holding rank, scanning most negative first, then zeros, then
+ * positives ascending. */
+static double ts_sketch_rank_value(const struct ts_sketch_set *s,
+                                   const struct ts_sketch *k, double rank) {
+  double seen = 0;
+
+  for (uint32_t b = k->neg.len; b-- > 0;) {
+    seen += k->neg.bins[b];
+    if (seen > rank) return -ts_sketch_bin_value(s, k->neg.offset + (int32_t)b);
+  }
+  seen += k->zero;
+  if (seen > rank) return 0;
+  for (uint32_t b = 0; b < k->pos.len; ++b) {
+    seen += k->pos.bins[b];
+    if (seen > rank) return ts_sketch_bin_value(s, k->pos.offset + (int32_t)b);
+  }
+  return k->max;
+}
+
+static double ts_sketch_quantile(const struct ts_sketch_set *s,
+                                 const struct ts_sketch *k, double q) {
+  if (k->count == 0 || !(q >= 0 && q <= 1)) return -1;
+
+  double v = ts_sketch_rank_value(s, k, q * (k->count - 1));
+  if (v < k->min) v = k->min;
+  if (v > k->max) v = k->max;
+  return v;
+}
+
+struct ts_sketch_set *ts_sketch_create(double alpha, const double *metrics,
+                                       size_t n, size_t exit_updates) {
+  if (!(alpha > 0 && alpha < 1) || !metrics || n == 0) return NULL;
+  if (n > TS_METRIC_COUNT) return NULL;
+
+  struct ts_sketch_set *s = calloc(1, sizeof(*s));
+  if (!s) return NULL;
+  s->alpha = alpha;
+  s->gamma = (1 + alpha) / (1 - alpha);
+  s->log_gamma = log(s->gamma);
+  s->nmetrics = n;
+  s->exit_updates = exit_updates;
+  for (size_t i = 0; i < n; ++i) {
+    if (!(metrics[i] >= 0 && metrics[i] < TS_METRIC_COUNT)) {
+      free(s);
+      return NULL;
+    }
+    s->metrics[i] = (size_t)metrics[i];
+  }
+  return s;
+}
+
+void ts_sketch_destroy(struct ts_sketch_set *s) {
+  if (!s) return;
+  for (size_t i = 0; i < s->count * s->nmetrics; ++i) {
+    ts_sketch_store_free(&s->sketches[i].pos);
+    ts_sketch_store_free(&s->sketches[i].neg);
+  }
+  free(s->sketches);
+  free(s->keys);
+  free(s->life);
+  free(s->index);
+  free(s);
+}
+
+size_t ts_sketch_size(const struct ts_sketch_set *s) {
+  return s ? s->count : 0;
+}
+
+/* Group rows (group, 0) are never folded; real identities have a start. */
+static int ts_sketch_exited(const struct ts_sketch_set *s, size_t i) {
+  if (s->exit_updates == 0 || s->keys[i].start == 0) return 0;
+  return s->updates - s->life[i].touched >= s->exit_updates;
+}
+
+/*
+ * Merge identities missing from the last exit_updates updates into the row
+ * (group, 0) of the group they were last updated under, and drop them, so a
+ * long capture keeps one row per live process rather than one per process
+ * ever seen, and grouping by the same keys afterwards loses nothing.
+ */
+static int ts_sketch_fold_exited(struct ts_sketch_set *s) {
+  size_t gone = 0;
+  size_t kept = 0;
+  size_t count = s->count;
+
+  for (size_t i = 0; i < count; ++i) {
+    gone += (size_t)ts_sketch_exited(s, i);
+  }
+  if (gone == 0) return 1;
+
+  /* By index: creating a group row may move the arrays */
+  for (size_t i = 0; i < count; ++i) {
+    if (!ts_sketch_exited(s, i)) continue;
+    double g = s->life[i].group;
+    struct ts_sketch *dead = ts_sketch_row(s, g, 0, g);
+    if (!dead) return 0;
+    size_t d = (size_t)(dead - s->sketches);
+    for (size_t j = 0; j < s->nmetrics; ++j) {
+      if (!ts_sketch_merge_one(&s->sketches[d + j],
+                               &s->sketches[i * s->nmetrics + j])) {
+        return 0;
+      }
+    }
+  }
+
+  /* Compact in place, keeping first-seen order */
+  for (size_t i = 0; i < s->count; ++i) {
+    struct ts_sketch *row = s->sketches + i * s->nmetrics;
+    if (ts_sketch_exited(s, i)) {
+      for (size_t j = 0; j < s->nmetrics; ++j) {
+        ts_sketch_store_free(&row[j].pos);
+        ts_sketch_store_free(&row[j].neg);
+      }
+      continue;
+    }
+    if (kept != i) {
+      s->keys[kept] = s->keys[i];
+      s->life[kept] = s->life[i];
+      memcpy(s->sketches + kept * s->nmetrics, row,
+             s->nmetrics * sizeof(*row));
+    }
+    kept++;
+  }
+  s->count = kept;
+  return ts_sketch_reindex(s, s->index_cap);
+}
+
+size_t ts_sketch_update(struct ts_sketch_set *s, const double *frame,
+                        size_t rows, size_t max_cols, const double *pids,
+                        double dt, const double *groups) {
+  size_t used = 0;
+
+  if (!s || !frame || !pids || max_cols <= TS_STARTTIME) return 0;
+  s->updates++;
+
+  for (size_t i = 0; i < rows; ++i) {
+    const double *row = frame + i * max_cols;
+    double start = row[TS_STARTTIME];
+    if (pids[i] == 0 || start == 0) continue;
+    double group = groups && groups[i] == groups[i] ? groups[i] : 0;
+
+    struct ts_sketch *sk = ts_sketch_row(s, pids[i], start, group);
+    if (!sk) break;
+    /* A delta frame reports 0 for counters it has no previous row for */
+    struct ts_sketch_life *life = &s->life[(size_t)(sk - s->sketches) /
+                                           s->nmetrics];
+    int counters = life->seen != 0 && life->seen + 1 == s->updates;
+    life->seen = life->touched = s->updates;
+    life->group = group;
+
+    for (size_t j = 0; j < s->nmetrics; ++j) {
+      size_t m = s->metrics[j];
+      double v = m < max_cols ? row[m] : -1;
+      if (v == -1 || v != v) continue;
+      if (ts_is_counter_metric(m)) {
+        if (!counters) continue;
+        if (dt > 0) v /= dt;
+      }
+      if (!ts_sketch_add(s, &sk[j], v)) return used;
+    }
+    used++;
+  }
+  ts_sketch_fold_exited(s);
+  return used;
+}
+
+size_t ts_sketch_quantiles(const struct ts_sketch_set *s, size_t slot,
+                           const double *qs, size_t nq, double *out,
+                           size_t max_rows, double *pid_out,
+                           double *start_out) {
+  if (!s || slot >= s->nmetrics) return 0;
+
+  size_t rows = s->count < max_rows ? s->count : max_rows;
+  for (size_t i = 0; i < rows; ++i) {
+    const struct ts_sketch *sk = &s->sketches[i * s->nmetrics + slot];
+    if (out && qs) {
+      for (size_t q = 0; q < nq; ++q) {
+        out[i * nq + q] = ts_sketch_quantile(s, sk, qs[q]);
+      }
+    }
+    if (pid_out) pid_out[i] = s->keys[i].pid;
+    if (start_out) start_out[i] = s->keys[i].start;
+  }
+  return s->count;
+}
+
+static int ts_sketch_compatible(const struct ts_sketch_set *a,
+                                const struct ts_sketch_set *b) {
+  if (a->alpha != b->alpha || a->nmetrics != b->nmetrics) return 0;
+  for (size_t j = 0; j < a->nmetrics; ++j) {
+    if (a->metrics[j] != b->metrics[j]) return 0;
+  }
+  return 1;
+}
+
+int ts_sketch_merge(struct ts_sketch_set *dst,
+                    const struct ts_sketch_set *src) {
+  if (!dst || !src || !ts_sketch_compatible(dst, src)) return 0;
+
+  for (size_t i = 0; i < src->count; ++i) {
+    struct ts_sketch *row = ts_sketch_row(dst, src->keys[i].pid,
+                                          src->keys[i].start,
+                                          src->life[i].group);
+    if (!row) return 0;
+    for (size_t j = 0; j < src->nmetrics; ++j) {
+      if (!ts_sketch_merge_one(&row[j], &src->sketches[i * src->nmetrics + j])) {
+        return 0;
+      }
+    }
+  }
+  return 1;
+}
+
+struct ts_sketch_set *ts_sketch_group(const struct ts_sketch_set *s,
+                                      const double *pids,
+                                      const double *starts,
+                                      const double *groups, size_t n) {
+  double metrics[TS_METRIC_COUNT];
+
+  if (!s || !pids || !starts || !groups) return NULL;
+  for (size_t j = 0; j < s->nmetrics; ++j) {
+    metrics[j] = (double)s->metrics[j];
+  }
+  struct ts_sketch_set *out =
+      ts_sketch_create(s->alpha, metrics, s->nmetrics, (size_t)s->exit_updates);
+  if (!out) return NULL;
+
+  for (size_t k = 0; k < n; ++k) {
+    if (!s->index_cap) break;
+    size_t h = ts_sketch_hash(pids[k], starts[k]) & (s->index_cap - 1);
+    size_t found = 0;
+    while (s->index[h]) {
+      size_t i = s->index[h] - 1;
+      if (s->keys[i].pid == pids[k] && s->keys[i].start == starts[k]) {
+        found = i + 1;
+        break;
+      }
+      h = (h + 1) & (s->index_cap - 1);
+    }
+    if (!found) continue;
+
+    struct ts_sketch *row = ts_sketch_row(out, groups[k], 0, groups[k]);
+    const struct ts_sketch *src = s->sketches + (found - 1) * s->nmetrics;
+    for (size_t j = 0; row && j < s->nmetrics; ++j) {
+      if (!ts_sketch_merge_one(&row[j], &src[j])) row = NULL;
+    }
+    if (!row) {
+      ts_sketch_destroy(out);
+      return NULL;
+    }
+  }
+  return out;
+}
+
+/*
+ * Encoding, little-endian whatever the host: u32 magic, u32 nmetrics,
+ * f64 alpha, u64 exit_updates, u64 count, u32 metrics[nmetrics], then per
+ * identity f64 pid, f64 start, f64 group and per metric f64 count, zero,
+ * min, max and the two stores as i32 offset, u32 len, u32 bins[len]. Update
+ * numbers are not saved.
+ */
+struct ts_sketch_cursor {
+  unsigned char *buf;
+  const unsigned char *in;
+  size_t cap;
+  size_t pos;
+};
+
+static void ts_sketch_put(struct ts_sketch_cursor *c, const void *p,
+                          size_t n) {
+  if (n && c->buf && c->pos + n <= c->cap) memcpy(c->buf + c->pos, p, n);
+  c->pos += n;
+}
+
+static int ts_sketch_get(struct ts_sketch_cursor *c, void *p, size_t n) {
+  if (c->pos + n > c->cap) return 0;
+  memcpy(p, c->in + c->pos, n);
+  c->pos += n;
+  return 1;
+}
+
+static void ts_sketch_put_u32(struct ts_sketch_cursor *c, uint32_t v) {
+  unsigned char b[4];
+  for (size_t k = 0; k < sizeof(b); ++k) b[k] = (unsigned char)(v >> (8 * k));
+  ts_sketch_put(c, b, sizeof(b));
+}
+
+static void ts_sketch_put_u64(struct ts_sketch_cursor *c, uint64_t v) {
+  unsigned char b[8];
+  for (size_t k = 0; k < sizeof(b); ++k) b[k] = (unsigned char)(v >> (8 * k));
+  ts_sketch_put(c, b, sizeof(b));
+}
+
+static void ts_sketch_put_f64(struct ts_sketch_cursor *c, double v) {
+  uint64_t u = 0;
+  memcpy(&u, &v, sizeof(u));
+  ts_sketch_put_u64(c, u);
+}
+
+static int ts_sketch_get_u32(struct ts_sketch_cursor *c, uint32_t *v) {
+  unsigned char b[4];
+  if (!ts_sketch_get(c, b, sizeof(b))) return 0;
+  *v = 0;
+  for (size_t k = 0; k < sizeof(b); ++k) *v |= (uint32_t)b[k] << (8 * k);
+  return 1;
+}
+
+static int ts_sketch_get_u64(struct ts_sketch_cursor *c, uint64_t *v) {
+  unsigned char b[8];
+  if (!ts_sketch_get(c, b, sizeof(b))) return 0;
+  *v = 0;
+  for (size_t k = 0; k < sizeof(b); ++k) *v |= (uint64_t)b[k] << (8 * k);
+  return 1;
+}
+
+static int ts_sketch_get_f64(struct ts_sketch_cursor *c, double *v) {
+  uint64_t u = 0;
+  if (!ts_sketch_get_u64(c, &u)) return 0;
+  memcpy(v, &u, sizeof(*v));
+  return 1;
+}
+
+static void ts_sketch_put_store(struct ts_sketch_cursor *c,
+                                const struct ts_sketch_store *st) {
+  uint32_t offset = 0;
+  memcpy(&offset, &st->offset, sizeof(offset));
+  ts_sketch_put_u32(c, offset);
+  ts_sketch_put_u32(c, st->len);
+  for (uint32_t k = 0; k < st->len; ++k) {
+    ts_sketch_put_u32(c, st->bins[k]);
+  }
+}
+
+static int ts_sketch_get_store(struct ts_sketch_cursor *c,
+                               struct ts_sketch_store *st) {
+  uint32_t offset = 0;
+  if (!ts_sketch_get_u32(c, &offset)) return 0;
+  if (!ts_sketch_get_u32(c, &st->len)) return 0;
+  memcpy(&st->offset, &offset, sizeof(st->offset));
+  if (st->len > TS_SKETCH_MAX_BINS) return 0;
+  if (st->offset < -TS_SKETCH_MAX_INDEX || st->offset > TS_SKETCH_MAX_INDEX) {
+    return 0;
+  }
+  if (st->len == 0) return 1;
+  /* Length-checked up front so a short buffer allocates nothing */
+  if (c->cap - c->pos < (size_t)st->len * sizeof(*st->bins)) return 0;
+  st->bins = malloc(st->len * sizeof(*st->bins));
+  if (!st->bins) return 0;
+  for (uint32_t k = 0; k < st->len; ++k) {
+    if (!ts_sketch_get_u32(c, &st->bins[k])) return 0;
+  }
+  return 1;
+}
+
+size_t ts_sketch_encode(const struct ts_sketch_set *s, void *out,
+                        size_t cap) {
+  struct ts_sketch_cursor c = {out, NULL, cap, 0};
+  uint32_t magic = TS_SKETCH_MAGIC;
+  uint32_t nmetrics = 0;
+  uint64_t count = 0;
+
+  if (!s) return 0;
+  nmetrics = (uint32_t)s->nmetrics;
+  count = s->count;
+  ts_sketch_put_u32(&c, magic);
+  ts_sketch_put_u32(&c, nmetrics);
+  ts_sketch_put_f64(&c, s->alpha);
+  ts_sketch_put_u64(&c, s->exit_updates);
+  ts_sketch_put_u64(&c, count);
+  for (size_t j = 0; j < s->nmetrics; ++j) {
+    ts_sketch_put_u32(&c, (uint32_t)s->metrics[j]);
+  }
+  for (size_t i = 0; i < s->count; ++i) {
+    ts_sketch_put_f64(&c, s->keys[i].pid);
+    ts_sketch_put_f64(&c, s->keys[i].start);
+    ts_sketch_put_f64(&c, s->life[i].group);
+    for (size_t j = 0; j < s->nmetrics; ++j) {
+      const struct ts_sketch *sk = &s->sketches[i * s->nmetrics + j];
+      ts_sketch_put_f64(&c, sk->count);
+      ts_sketch_put_f64(&c, sk->zero);
+      ts_sketch_put_f64(&c, sk->min);
+      ts_sketch_put_f64(&c, sk->max);
+      ts_sketch_put_store(&c, &sk->pos);
+      ts_sketch_put_store(&c, &sk->neg);
+    }
+  }
+  return c.pos;
+}
+
+static int ts_sketch_decode_row(struct ts_sketch_cursor *c,
+                                struct ts_sketch_set *s, uint64_t i) {
+  struct ts_sketch_key key;
+  double group = 0;
+
+  if (!ts_sketch_get_f64(c, &key.pid) || !ts_sketch_get_f64(c, &key.start) ||
+      !ts_sketch_get_f64(c, &group)) {
+    return 0;
+  }
+  /* A repeated key would return the row already filled */
+  struct ts_sketch *row = ts_sketch_row(s, key.pid, key.start, group);
+  if (!row || s->count != i + 1) return 0;
+
+  for (size_t j = 0; j < s->nmetrics; ++j) {
+    struct ts_sketch *sk = &row[j];
+    if (!ts_sketch_get_f64(c, &sk->count) ||
+        !ts_sketch_get_f64(c, &sk->zero) ||
+        !ts_sketch_get_f64(c, &sk->min) ||
+        !ts_sketch_get_f64(c, &sk->max) ||
+        !ts_sketch_get_store(c, &sk->pos) ||
+        !ts_sketch_get_store(c, &sk->neg)) {
+      return 0;
+    }
+  }
+  return 1;
+}
+
+struct ts_sketch_set *ts_sketch_decode(const void *in, size_t len) {
+  struct ts_sketch_cursor c = {NULL, in, len, 0};
+  double metrics[TS_METRIC_COUNT];
+  uint32_t magic = 0;
+  uint32_t nmetrics = 0;
+  uint64_t exit_updates = 0;
+  uint64_t count = 0;
+  double alpha = 0;
+
+  if (!in) return NULL;
+  if (!ts_sketch_get_u32(&c, &magic) || magic != TS_SKETCH_MAGIC) {
+    return NULL;
+  }
+  if (!ts_sketch_get_u32(&c, &nmetrics) || nmetrics > TS_METRIC_COUNT ||
+      !ts_sketch_get_f64(&c, &alpha) ||
+      !ts_sketch_get_u64(&c, &exit_updates) ||
+      !ts_sketch_get_u64(&c, &count)) {
+    return NULL;
+  }
+  for (uint32_t j = 0; j < nmetrics; ++j) {
+    uint32_t m = 0;
+    if (!ts_sketch_get_u32(&c, &m)) return NULL;
+    metrics[j] = (double)m;
+  }
+
+  struct ts_sketch_set *s =
+      ts_sketch_create(alpha, metrics, nmetrics, (size_t)exit_updates);
+  if (!s) return NULL;
+  for (uint64_t i = 0; i < count; ++i) {
+    if (!ts_sketch_decode_row(&c, s, i)) {
+      ts_sketch_destroy(s);
+      return NULL;
+    }
+  }
+  return s;
+}
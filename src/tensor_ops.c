@@ -0,0 +1,150 @@
+#include "tensorscan.h"
+#include <stdlib.h>
+#include <string.h>
+
+#if (defined(__x86_64__) || defined(__i386__)) && defined(__GNUC__)
+#include <immintrin.h>
+#define TS_HAVE_AVX2 1
+#endif
+
+/* Tensor kernels that operate on BQN-built arrays rather than on /proc. */
+
+size_t ts_core_index(const double *tensor, size_t n, size_t m, size_t cores,
+                     int32_t *index_out) {
+  size_t valid = 0;
+
+  if (!tensor || !index_out || m <= TS_PROCESSOR) return 0;
+
+  for (size_t i = 0; i < n; ++i) {
+    double id = tensor[i * m + TS_PROCESSOR];
+    if (id >= 0 && id < (double)cores) {
+      index_out[i] = (int32_t)id;
+      valid++;
+    } else {
+      index_out[i] = -1;
+    }
+  }
+  return valid;
+}
+
+size_t ts_core_dense_slice(const double *tensor, const int32_t *core_index,
+                           size_t n, size_t m, size_t metric, size_t cores,
+                           double *out) {
+  if (!tensor || !out || metric >= m || cores == 0) return 0;
+
+  if (metric == TS_PROCESSOR) {
+    if (!core_index) return 0;
+    memset(out, 0, n * cores * sizeof(*out));
+    for (size_t i = 0; i < n; ++i) {
+      int32_t core = core_index[i];
+      if (core >= 0 && (size_t)core < cores) {
+        out[i * cores + (size_t)core] = 1;
+      }
+    }
+    return n;
+  }
+
+  for (size_t i = 0; i < n; ++i) {
+    double v = tensor[i * m + metric];
+    double *row = out + (i * cores);
+    for (size_t c = 0; c < cores; ++c) {
+      row[c] = v;
+    }
+  }
+  return n;
+}
+
+/*
+ * One delta row of `lanes` = m×c values. ctr marks counter lanes, pair marks
+ * lanes whose identity is present in both frames. Counters become clamped
+ * deltas over dt (0 across a -1 sentinel); gauges take the later frame.
+ */
+static void ts_delta_row_scalar(const double *prev, const double *curr,
+                                const double *ctr, const double *pair,
+                                double dt, double *out, size_t lanes) {
+  for (size_t e = 0; e < lanes; ++e) {
+    double d = 0;
+
+    if (ctr[e] == 0) {
+      out[e] = curr[e];
+      continue;
+    }
+    if (pair[e] != 0 && prev[e] != -1 && curr[e] != -1) d = curr[e] - prev[e];
+    out[e] = (d > 0 ? d : 0) / dt;
+  }
+}
+
+#ifdef TS_HAVE_AVX2
+__attribute__((target("avx2"))) static void
+ts_delta_row_avx2(const double *prev, const double *curr, const double *ctr,
+                  const double *pair, double dt, double *out, size_t lanes) {
+  const __m256d zero = _mm256_setzero_pd();
+  const __m256d sentinel = _mm256_set1_pd(-1.0);
+  const __m256d vdt = _mm256_set1_pd(dt);
+  size_t e = 0;
+
+  for (; e + 4 <= lanes; e += 4) {
+    __m256d a = _mm256_loadu_pd(prev + e);
+    __m256d b = _mm256_loadu_pd(curr + e);
+    __m256d valid =
+        _mm256_cmp_pd(_mm256_loadu_pd(pair + e), zero, _CMP_NEQ_UQ);
+    valid = _mm256_and_pd(valid, _mm256_cmp_pd(a, sentinel, _CMP_NEQ_UQ));
+    valid = _mm256_and_pd(valid, _mm256_cmp_pd(b, sentinel, _CMP_NEQ_UQ));
+    __m256d d = _mm256_and_pd(valid, _mm256_sub_pd(b, a));
+    __m256d rate = _mm256_div_pd(_mm256_max_pd(d, zero), vdt);
+    __m256d counter =
+        _mm256_cmp_pd(_mm256_loadu_pd(ctr + e), zero, _CMP_NEQ_UQ);
+    _mm256_storeu_pd(out + e, _mm256_blendv_pd(b, rate, counter));
+  }
+  ts_delta_row_scalar(prev + e, curr + e, ctr + e, pair + e, dt, out + e,
+                      lanes - e);
+}
+#endif
+
+size_t ts_to_deltas(const double *tensor, const double *times, size_t t,
+                    size_t p, size_t m, size_t c, const double *counter_mask,
+                    double *out) {
+  void (*row_fn)(const double *, const double *, const double *,
+                 const double *, double, double *, size_t) =
+      ts_delta_row_scalar;
+
+  if (!tensor || !times || !counter_mask || !out) return 0;
+  if (t < 2 || m <= TS_STARTTIME || c == 0) return 0;
+
+  size_t lanes = m * c;
+  double *ctr = malloc(2 * lanes * sizeof(*ctr));
+  if (!ctr) return 0;
+  double *pair = ctr + lanes;
+
+  for (size_t k = 0; k < m; ++k) {
+    for (size_t j = 0; j < c; ++j) {
+      ctr[k * c + j] = counter_mask[k] != 0;
+    }
+  }
+#ifdef TS_HAVE_AVX2
+  if (__builtin_cpu_supports("avx2")) row_fn = ts_delta_row_avx2;
+#endif
+
+  for (size_t f = 0; f + 1 < t; ++f) {
+    double dt = times[f + 1] - times[f];
+    if (dt == 0) dt = 1;
+
+    for (size_t i = 0; i < p; ++i) {
+      const double *prev = tensor + (f * p + i) * lanes;
+      const double *curr = prev + p * lanes;
+
+      /* Presence is a nonzero starttime in both frames, per core lane */
+      for (size_t j = 0; j < c; ++j) {
+        pair[j] = prev[TS_STARTTIME * c + j] > 0 &&
+                  curr[TS_STARTTIME * c + j] > 0;
+      }
+      for (size_t k = 1; k < m; ++k) {
+        memcpy(pair + k * c, pair, c * sizeof(*pair));
+      }
+      row_fn(prev, curr, ctr, pair, dt, out + (f * p + i) * lanes, lanes);
+    }
+  }
+
+  free(ctr);
+  return t - 1;
+}
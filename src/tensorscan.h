@@ -2,6 +2,7 @@
 #define TENSORSCAN_H
 
 #include <stddef.h>
+#include <stdint.h>
 #include <sys/types.h>
 
 #ifdef __cplusplus
@@ -30,6 +31,46 @@ enum ts_metric_index {
   TS_MAJFLT = 16
 };
 
+/* Element types for typed snapshots. Values are passed as doubles over FFI. */
+enum ts_elem_type {
+  TS_ELEM_F64 = 0,
+  TS_ELEM_F32 = 1,
+  TS_ELEM_I32 = 2
+};
+
+/* Read flags a governor plan applies to captures on its thread. */
+enum ts_read_flag {
+  TS_READ_SKIP_IO = 1,    /* skip /proc/<pid>/io; io columns read -1 */
+  TS_READ_STRIDE = 2   /* read only pids (tids) that are multiples of the
+                          power of two bringing the ids that pass the
+                          filter down to max_rows; listed pids are kept */
+};
+
+/* Fields of a sampling plan written by ts_governor_step. */
+enum ts_plan_field {
+  TS_PLAN_INTERVAL = 0, /* seconds until the next frame */
+  TS_PLAN_ROWS = 1,     /* max_rows for the next capture */
+  TS_PLAN_FLAGS = 2,    /* enum ts_read_flag mask in force */
+  TS_PLAN_LEVEL = 3,    /* degradation level, 0 = unthrottled */
+  TS_PLAN_CPU = 4,      /* measured collector CPU, fraction of one core */
+  TS_PLAN_BUDGET = 5,
+  TS_PLAN_STRIDE = 6,   /* stride k the last capture on this thread read
+                           (1 = every id); reported by the following step */
+  TS_PLAN_FIELD_COUNT = 7
+};
+
+/* Cumulative process-event counters reported by ts_proc_events_stats. */
+enum ts_event_stat {
+  TS_EV_FORKS = 0,    /* processes created (thread clones excluded) */
+  TS_EV_EXECS = 1,
+  TS_EV_EXITS = 2,    /* processes whose last task exited */
+  TS_EV_CAPTURED = 3, /* exits whose final row was queued */
+  TS_EV_MISSED = 4,   /* reaped before it was read, or start unknown */
+  TS_EV_DROPPED = 5,  /* rows lost to a full queue or socket overrun */
+  TS_EV_EVICTED = 6,  /* running groups whose thread sums were evicted */
+  TS_EV_STAT_COUNT = 7
+};
+
 /*
  * Fill a caller-provided buffer with current process stats.
  *
@@ -52,6 +93,81 @@ size_t ts_snapshot_filtered(double *out, size_t max_rows, size_t max_cols,
                             const double *pid_whitelist,
                             size_t whitelist_count, double only_uid);
 
+/*
+ * Compiled predicate filter. Build once, then pass to the *_compiled
+ * snapshots. Within a predicate kind any entry may match; across kinds all
+ * must match; kinds with no entries accept everything. Each predicate is
+ * checked as soon as its field has been read: pid before any file, comm and
+ * ppid after /proc/<pid>/stat, cgroup and cmdline from their own files
+ * (read only when such predicates exist), uid after status.
+ * comm and cmdline take fnmatch globs ("postgres*" is a prefix match);
+ * cgroup takes literal path prefixes matched against each hierarchy's path
+ * by whole components: "/sys" matches "/sys/a" but not "/system.slice".
+ */
+struct ts_compiled_filter;
+
+struct ts_compiled_filter *ts_filter_create(size_t ignored);
+void ts_filter_destroy(struct ts_compiled_filter *f);
+int ts_filter_add_pids(struct ts_compiled_filter *f, const double *pids,
+                       size_t n);
+int ts_filter_add_uids(struct ts_compiled_filter *f, const double *uids,
+                       size_t n);
+int ts_filter_add_ppids(struct ts_compiled_filter *f, const double *ppids,
+                        size_t n);
+int ts_filter_add_comm(struct ts_compiled_filter *f, const char *pattern);
+int ts_filter_add_cgroup(struct ts_compiled_filter *f, const char *prefix);
+int ts_filter_add_cmdline(struct ts_compiled_filter *f, const char *pattern);
+/* Sort and deduplicate the id sets. Call after the last add. */
+int ts_filter_compile(struct ts_compiled_filter *f);
+
+/* Snapshot of the processes accepted by a compiled filter. */
+size_t ts_snapshot_compiled(double *out, size_t max_rows, size_t max_cols,
+                            double *pid_out,
+                            const struct ts_compiled_filter *filter);
+
+/* Delta snapshot restricted by a compiled filter (see ts_snapshot_delta). */
+size_t ts_snapshot_delta_compiled(double *out, size_t max_rows,
+                                  size_t max_cols, double *pid_out,
+                                  const struct ts_compiled_filter *filter);
+
+/*
+ * Per-thread snapshot from /proc/<pid>/task/<tid>. Emits one row per
+ * thread with the same metric catalog (starttime is the thread's), for the
+ * processes accepted by filter (NULL = all). Rows are sorted by tid, so
+ * ⟨tid, starttime⟩ is a stable key; tgid_out maps rows back to processes.
+ * tgid_out/tid_out may be NULL. Returns the total threads found.
+ */
+size_t ts_snapshot_threads(double *out, size_t max_rows, size_t max_cols,
+                           double *tgid_out, double *tid_out,
+                           const struct ts_compiled_filter *filter);
+
+/* Delta variant of ts_snapshot_threads with its own previous frame;
+ * tid_out must be non-NULL. */
+size_t ts_snapshot_delta_threads(double *out, size_t max_rows, size_t max_cols,
+                                 double *tgid_out, double *tid_out,
+                                 const struct ts_compiled_filter *filter);
+
+/*
+ * Adaptive delta snapshot: each PID×StartTime identity is re-read on its own
+ * period. An identity whose counters grew since its last read is read every
+ * frame; an idle one doubles its period after each read, up to 16 frames.
+ * New identities start at every frame. Each identity's reads fall on a phase
+ * hashed from its pid and starttime, so identities that went idle together
+ * are re-read on different frames. Identities that are not due are not
+ * read: their row carries the last gauges forward, reports 0 for counters
+ * and sets stale_out to 1. On a fresh read, counter deltas cover everything
+ * since that identity's previous read, and span_out holds that span in
+ * seconds (0 on first sight), so delta / span is the rate over a variable
+ * gap. Every live PID is listed: there is no filter, and of the governor's
+ * read flags only TS_READ_SKIP_IO applies (TS_READ_STRIDE is ignored; the
+ * schedule already bounds reads). pid_out must be non-NULL; passing NULL
+ * resets the schedule. stale_out/span_out may be NULL. Returns the number
+ * of live identities.
+ */
+size_t ts_snapshot_delta_adaptive(double *out, size_t max_rows,
+                                  size_t max_cols, double *pid_out,
+                                  double *stale_out, double *span_out);
+
 /*
  * Delta-ready snapshot. Counter metrics return per-interval deltas if a
  * previous snapshot exists, otherwise 0. Non-counter metrics are absolute.
@@ -61,6 +177,252 @@ size_t ts_snapshot_filtered(double *out, size_t max_rows, size_t max_cols,
 size_t ts_snapshot_delta(double *out, size_t max_rows, size_t max_cols,
                          double *pid_out);
 
+/*
+ * Metric-major (column) snapshot. Metric m of row i is written to
+ * out[m * col_stride + i], so each metric is a contiguous column of
+ * TS_METRIC_COUNT columns; out must hold TS_METRIC_COUNT * col_stride
+ * doubles and col_stride must be >= max_rows. Returns the same totals as
+ * ts_snapshot.
+ */
+size_t ts_snapshot_columns(double *out, size_t max_rows, size_t col_stride,
+                           double *pid_out);
+
+/* Metric-major variant of ts_snapshot_delta. Shares its previous-frame
+ * state, so mixing the two layouts on one thread is allowed. */
+size_t ts_snapshot_delta_columns(double *out, size_t max_rows,
+                                 size_t col_stride, double *pid_out);
+
+/*
+ * Sparse change-only delta frame (coordinate format). Captures up to
+ * max_rows processes and emits, against the previous COO frame on this
+ * thread:
+ *   triples: rows of [pid, metric, value] for non-zero counter deltas,
+ *            counters entering or leaving the -1 sentinel, and gauges that
+ *            changed (for births: non-zero gauges). starttime is never
+ *            emitted; it travels with the birth event.
+ *   events:  rows of [pid, starttime, kind], kind +1 = birth, -1 = exit.
+ * Both buffers are row-major with 3 columns. counts_out[0..2] receives the
+ * total triples, total events and captured rows. If a total exceeds its
+ * buffer the frame is truncated and NOT committed: the next call is taken
+ * against the same previous frame, so retrying with larger buffers loses
+ * nothing. Applying a frame to the previous dense frame (counters reset to
+ * 0 except -1 sentinels, gauges carried forward) reproduces
+ * ts_snapshot_delta. Returns the total process count.
+ */
+size_t ts_snapshot_delta_coo(size_t max_rows, double *triples,
+                             size_t max_triples, double *events,
+                             size_t max_events, double *counts_out);
+
+/* Dense delta frame (ts_snapshot_delta layout) behind the last committed
+ * ts_snapshot_delta_coo call on this thread. Returns its row count. */
+size_t ts_coo_dense(double *out, size_t max_rows, size_t max_cols,
+                    double *pid_out);
+
+/*
+ * Process lifecycle listener (Linux netlink proc connector, needs
+ * CAP_NET_ADMIN). A background thread counts fork/exec events and queues a
+ * final row when the last task of a process exits. The row comes from the
+ * kernel's taskstats exit records (v12+), which cannot be lost to reaping;
+ * starttime is the /proc value, read when the fork is seen (or when the
+ * listener starts), so rows key exactly like snapshot rows. Without
+ * taskstats the row is read from /proc/<pid> while it is still a zombie. Those rows catch processes born and gone between two snapshots.
+ * Up to 'capacity' rows are queued until drained. Returns 1 when listening,
+ * or if already listening. Returns 0 when unavailable: capacity 0, no
+ * privilege, no connector, or not Linux.
+ */
+int ts_proc_events_start(size_t capacity);
+
+/* Stop the listener and discard queued rows; takes a dummy argument. */
+void ts_proc_events_stop(size_t ignored);
+
+/*
+ * Move queued exit rows, oldest first, into out (row-major, same metric
+ * catalog and units as ts_snapshot, counters absolute). pid_out may be NULL.
+ * Rows beyond max_rows stay queued. Returns rows written.
+ */
+size_t ts_proc_events_drain(double *out, size_t max_rows, size_t max_cols,
+                            double *pid_out);
+
+/* Copy up to n counters indexed by enum ts_event_stat since the last start.
+ * Returns the number written. */
+size_t ts_proc_events_stats(double *out, size_t n);
+
+/*
+ * Embedded OpenMetrics exporter. A background thread serves the newest
+ * frame as OpenMetrics text over HTTP on "unix:<path>", "<port>",
+ * "127.0.0.1:<port>" or "localhost:<port>" (loopback only); a unix socket
+ * is created owner-only (0600), whatever the umask. An existing socket at
+ * the path is replaced only if nothing accepts connections on it. The frame is
+ * either the last one handed to ts_exporter_publish, or one captured on each
+ * scrape when capture_on_scrape is non-zero. Per-process series carry pid,
+ * comm and cgroup labels, cached by PID×StartTime. Only the top_n processes
+ * by CPU since the previous scrape get their own series; the rest are folded
+ * into a comm="other" series. Buffers are reused across scrapes and only
+ * grow. Returns 1 when serving, or if already serving, and 0 if the address
+ * is invalid or cannot be bound.
+ */
+int ts_exporter_start(const char *addr, size_t top_n, int capture_on_scrape);
+
+/* Stop the exporter thread and release its socket and buffers. */
+void ts_exporter_stop(size_t ignored);
+
+/*
+ * Publish an absolute row-major frame, sorted by pid as every snapshot call
+ * returns it, for the exporter to serve. Delta frames would be exposed as
+ * totals, so pass ts_snapshot-style output. The frame is copied. Returns
+ * the rows accepted; 0 when the exporter is not running.
+ */
+size_t ts_exporter_publish(const double *frame, size_t rows, size_t max_cols,
+                           const double *pids);
+
+/*
+ * Overhead governor. Call ts_governor_step once per frame on the sampling
+ * thread. It measures the process's own CPU time (utime + stime) since the
+ * last step as a fraction of one core. Each over-budget step degrades the
+ * plan one level: the interval doubles up to 8x, then io reads are skipped,
+ * then max_rows halves up to 8x with TS_READ_STRIDE. The strided scan
+ * reads a fixed pid subset spread over the whole pid range, so the same
+ * processes stay comparable between frames. The stride is computed over the
+ * ids that pass the capture's filter, held steady while that count hovers
+ * at a power-of-two boundary, and reported as TS_PLAN_STRIDE by the next
+ * step. Under TS_READ_STRIDE a
+ * snapshot's return value counts the processes found in that subset, not
+ * the system total, so it no longer signals truncation. Three steps under
+ * half the budget undo one level. The step applies the read flags to the
+ * calling thread and writes up to n TS_PLAN_* fields to plan_out. Returns
+ * the fields written. Destroy clears the read flags, so create, step and
+ * destroy on the sampling thread. Create returns NULL if budget, interval
+ * or rows is not positive.
+ */
+struct ts_governor;
+
+struct ts_governor *ts_governor_create(double budget, double interval,
+                                       size_t rows);
+void ts_governor_destroy(struct ts_governor *g);
+size_t ts_governor_step(struct ts_governor *g, double *plan_out, size_t n);
+
+/*
+ * Quantile sketches (DDSketch) per PID×StartTime identity and selected
+ * metric, with quantiles accurate to alpha relative error (0.01 = 1%).
+ * ts_sketch_update adds one row-major delta frame: counter metrics are
+ * divided by dt when dt > 0, so they become rates, gauges are taken as is,
+ * and -1 values are skipped. A delta frame reports 0 for counters of an
+ * identity it has no previous row for, so counters are only sampled when the
+ * identity was also in the previous update. groups, when not NULL, gives
+ * each frame row a group key (0 otherwise). With exit_updates > 0,
+ * identities missing from that many consecutive updates are merged into the
+ * row (group, 0) of the group they were last updated under and dropped;
+ * 0 keeps every identity. ts_sketch_quantiles writes a rows×nq matrix for
+ * metric slot (an index into the create list) in first-seen order, with -1
+ * where a sketch has no samples, and returns the identity count.
+ * ts_sketch_group merges the listed identities into a new set keyed by
+ * (group, 0); ts_sketch_merge folds src into dst, which must use the same
+ * alpha and metric list. ts_sketch_encode returns the encoded size and
+ * writes it when cap allows, in a fixed little-endian layout, so sets from
+ * separate captures (and hosts) can be saved, decoded and merged. Bin
+ * indexes are clamped, so any alpha in (0, 1) is safe. Sets are not locked.
+ */
+struct ts_sketch_set;
+
+struct ts_sketch_set *ts_sketch_create(double alpha, const double *metrics,
+                                       size_t n, size_t exit_updates);
+void ts_sketch_destroy(struct ts_sketch_set *s);
+size_t ts_sketch_size(const struct ts_sketch_set *s);
+size_t ts_sketch_update(struct ts_sketch_set *s, const double *frame,
+                        size_t rows, size_t max_cols, const double *pids,
+                        double dt, const double *groups);
+size_t ts_sketch_quantiles(const struct ts_sketch_set *s, size_t slot,
+                           const double *qs, size_t nq, double *out,
+                           size_t max_rows, double *pid_out,
+                           double *start_out);
+struct ts_sketch_set *ts_sketch_group(const struct ts_sketch_set *s,
+                                      const double *pids,
+                                      const double *starts,
+                                      const double *groups, size_t n);
+int ts_sketch_merge(struct ts_sketch_set *dst,
+                    const struct ts_sketch_set *src);
+size_t ts_sketch_encode(const struct ts_sketch_set *s, void *out, size_t cap);
+struct ts_sketch_set *ts_sketch_decode(const void *in, size_t len);
+
+/* Run the calling thread under SCHED_IDLE, or pin it to one CPU. Return 1
+ * on success, 0 if refused or unsupported (macOS). */
+int ts_sampler_set_idle(size_t ignored);
+int ts_sampler_set_affinity(size_t cpu);
+
+/*
+ * Fill types_out/scales_out (length n) with the catalog's compact schema
+ * for absolute snapshots: int32 for ids and gauges (rss scaled by the page
+ * size), float32 for vsize, and float64 for starttime so PID×StartTime keys
+ * stay exact and for cumulative counters, which outgrow int32. Entries past
+ * the catalog are TS_ELEM_F64. Returns the number of entries written.
+ */
+size_t ts_get_metric_schema(double *types_out, double *scales_out, size_t n);
+
+/*
+ * Schema for ts_snapshot_delta_typed: as ts_get_metric_schema, but counter
+ * deltas are int32, CPU time scaled by the tick (1 us on macOS) and io by
+ * the 512-byte unit the kernel counts in.
+ */
+size_t ts_get_delta_schema(double *types_out, double *scales_out, size_t n);
+
+/* Number of int32 values clamped by the last typed snapshot on this thread;
+ * nonzero means the schema's range was exceeded. */
+size_t ts_typed_saturated(size_t ignored);
+
+/* Bytes per packed row for a schema of max_cols columns. */
+size_t ts_schema_row_bytes(const double *types, size_t max_cols);
+
+/*
+ * Typed snapshot. Rows are packed back to back, ts_schema_row_bytes() bytes
+ * each; column j is stored as types[j] at the sum of the widths of the
+ * columns before it, in native byte order. TS_ELEM_I32 columns hold
+ * round(value / scales[j]), saturated to the int32 range (counted by
+ * ts_typed_saturated); negative values
+ * are stored unscaled so -1 sentinels and signed gauges survive. Scales are
+ * ignored for float columns. PIDs are written to pid_out as int32.
+ * Rows are encoded as the driver reads them; no float64 copy is staged.
+ * Returns the same totals as ts_snapshot.
+ */
+size_t ts_snapshot_typed(void *out, size_t max_rows, size_t max_cols,
+                         const double *types, const double *scales,
+                         int32_t *pid_out);
+
+/* Typed variant of ts_snapshot_delta, sharing its previous frame; pid_out
+ * must be non-NULL. Rows are encoded from the delta state's own frame. */
+size_t ts_snapshot_delta_typed(void *out, size_t max_rows, size_t max_cols,
+                               const double *types, const double *scales,
+                               int32_t *pid_out);
+
+/*
+ * Sparse core axis. A t×p×m tensor (n = t×p rows of m metrics) keeps each
+ * scalar metric once; the core assignment is the processor column as an
+ * int32 index, -1 where the core is unknown or >= cores. Returns the number
+ * of rows with a valid core.
+ */
+size_t ts_core_index(const double *tensor, size_t n, size_t m, size_t cores,
+                     int32_t *index_out);
+
+/*
+ * Materialize one metric of a sparse tensor as a dense n×cores slice that
+ * matches the 4D layout: TS_PROCESSOR is one-hot from core_index, every
+ * other metric is broadcast across cores. Returns rows written.
+ */
+size_t ts_core_dense_slice(const double *tensor, const int32_t *core_index,
+                           size_t n, size_t m, size_t metric, size_t cores,
+                           double *out);
+
+/*
+ * Counter-rate tensor in one pass. tensor is t×p×m×c (aligned frames, row
+ * major), times holds the t timestamps and counter_mask the m metric flags.
+ * out is (t-1)×p×m×c: counter lanes get max(0, curr - prev) / dt where the
+ * identity is present in both frames (nonzero starttime) and neither value
+ * is -1, else 0; gauge lanes copy the later frame. A zero dt counts as 1.
+ * Uses AVX2 when the CPU has it. Returns the number of frames written.
+ */
+size_t ts_to_deltas(const double *tensor, const double *times, size_t t,
+                    size_t p, size_t m, size_t c, const double *counter_mask,
+                    double *out);
+
 /* Return number of online processors; takes a dummy argument for FFI. */
 size_t ts_core_count(size_t ignored);
 